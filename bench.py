@@ -35,13 +35,29 @@ def main():
         "-s", "--streams", type=int, default=None,
         help="Number of streams per device (default: all available)"
     )
+    parser.add_argument(
+        "--cpu-devices", type=int, default=1,
+        help="Number of virtual devices to split the CPU cores into (default: 1, CPU only)"
+    )
+    parser.add_argument(
+        "--affinity", choices=["none", "compact", "scatter"], default=None,
+        help="Pin the native worker threads to CPUs (default: none, CPU only)"
+    )
+    parser.add_argument(
+        "-b", "--batch", action="store_true",
+        help="Use a single selfjoin_batch call with one thread per stream (CPU only)"
+    )
+    parser.add_argument(
+        "-a", "--async", dest="use_async", action="store_true",
+        help="Submit with selfjoin_async from a single thread instead of a thread pool"
+    )
     args = parser.parse_args()
 
     print(f"Generating {args.count} time series of length {args.length}...")
     np.random.seed(42)
     timeseries_list = [np.random.rand(args.length) for _ in range(args.count)]
 
-    quickmp.initialize()
+    quickmp.initialize(cpu_devices=args.cpu_devices, affinity=args.affinity)
 
     max_devices = quickmp.get_device_count()
     if args.devices is not None and args.devices > max_devices:
@@ -56,8 +72,8 @@ def main():
         if args.streams is not None and args.streams > max_streams:
             quickmp.finalize()
             sys.exit(f"Error: Device {d} has only {max_streams} streams, but {args.streams} requested")
-        if num_streams is None:
-            num_streams = args.streams if args.streams else max_streams
+        # Virtual CPU devices may have one core less than the first one
+        num_streams = args.streams if args.streams else min(num_streams or max_streams, max_streams)
 
     total_workers = num_devices * num_streams
 
@@ -67,6 +83,34 @@ def main():
         for s in range(num_streams):
             quickmp.selfjoin(timeseries_list[0], args.window, stream=s)
 
+    if args.batch:
+        Ts = np.stack(timeseries_list)
+        print(f"Computing matrix profiles with selfjoin_batch on {num_streams} thread(s)...")
+
+        start = time.perf_counter()
+        quickmp.selfjoin_batch(Ts, args.window, num_threads=num_streams)
+        elapsed = time.perf_counter() - start
+
+        quickmp.finalize()
+        report(args.count, elapsed)
+        return
+
+    if args.use_async:
+        print(f"Computing matrix profiles with selfjoin_async on {num_devices} device(s) x {num_streams} stream(s)...")
+
+        start = time.perf_counter()
+        pending = []
+        for idx, T in enumerate(timeseries_list):
+            quickmp.use_device(idx % num_devices)
+            stream_id = (idx // num_devices) % num_streams
+            pending.append(quickmp.selfjoin_async(T, args.window, stream=stream_id))
+        results = [p.result() for p in pending]
+        elapsed = time.perf_counter() - start
+
+        quickmp.finalize()
+        report(args.count, elapsed)
+        return
+
     # Create barrier for synchronization
     barrier = threading.Barrier(total_workers + 1)
     first_task_done = [False] * total_workers  # Track first task per worker
@@ -102,9 +146,13 @@ def main():
 
     quickmp.finalize()
 
-    print(f"Completed {args.count} matrix profiles in {elapsed:.3f} seconds")
-    print(f"Throughput: {args.count / elapsed:.2f} profiles/sec")
-    print(f"Average time per profile: {elapsed / args.count * 1000:.3f} ms")
+    report(args.count, elapsed)
+
+
+def report(count, elapsed):
+    print(f"Completed {count} matrix profiles in {elapsed:.3f} seconds")
+    print(f"Throughput: {count / elapsed:.2f} profiles/sec")
+    print(f"Average time per profile: {elapsed / count * 1000:.3f} ms")
 
 
 if __name__ == "__main__":
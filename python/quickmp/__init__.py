@@ -4,13 +4,34 @@ from ._version import __version__
 __all__ = [
     "initialize",
     "finalize",
+    "list_backends",
+    "get_backend",
     "get_device_count",
     "use_device",
     "get_current_device",
     "get_stream_count",
+    "get_cpu_topology",
+    "trim_memory_pool",
     "sliding_dot_product",
     "compute_mean_std",
     "selfjoin",
     "abjoin",
+    "selfjoin_async",
+    "abjoin_async",
+    "stream_synchronize",
+    "stream_wait_event",
+    "Event",
+    "AsyncResult",
+    "selfjoin_batch",
+    "abjoin_batch",
+    "selfjoin_file",
+    "abjoin_file",
+    "selfjoin_tile",
+    "merge_profiles",
+    "topk_motifs",
+    "topk_discords",
+    "Plan",
+    "StreamingSelfJoin",
+    "AnytimeSelfJoin",
     "__version__",
 ]
@@ -1,42 +1,895 @@
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
 #include <nanobind/nanobind.h>
 #include <nanobind/ndarray.h>
+#include <nanobind/stl/optional.h>
 #include <nanobind/stl/pair.h>
+#include <nanobind/stl/string.h>
+#include <nanobind/stl/tuple.h>
+#include <nanobind/stl/vector.h>
 
+#include "host_pool.hpp"
 #include "quickmp.hpp"
 
 namespace nb = nanobind;
 using namespace nb::literals;
 
+template <typename Scalar>
 using const_pyarr_t =
-    nb::ndarray<const double, nb::numpy, nb::ndim<1>, nb::c_contig, nb::device::cpu>;
-using pyarr_t = nb::ndarray<double, nb::numpy, nb::ndim<1>, nb::c_contig, nb::device::cpu>;
+    nb::ndarray<const Scalar, nb::numpy, nb::ndim<1>, nb::c_contig, nb::device::cpu>;
+template <typename Scalar>
+using pyarr_t = nb::ndarray<Scalar, nb::numpy, nb::ndim<1>, nb::c_contig, nb::device::cpu>;
+using index_pyarr_t =
+    nb::ndarray<int64_t, nb::numpy, nb::ndim<1>, nb::c_contig, nb::device::cpu>;
+using any_pyarr_t = nb::ndarray<nb::ro, nb::numpy, nb::ndim<1>, nb::device::cpu>;
 
-static bool g_initialized = false;
+// Atomic since the module does not rely on the GIL (g_init_mutex is taken with the GIL released)
+static std::atomic<bool> g_initialized(false);
+static std::mutex g_init_mutex;
 
-NB_MODULE(_quickmp, m) {
+template <typename T>
+static const char *dtype_name() {
+    if (std::is_same<T, float>::value) {
+        return "float32";
+    }
+    return std::is_same<T, double>::value ? "float64" : "int64";
+}
+
+// Buffer from the host memory pool handed over to numpy without a copy. Arrays created by view()
+// share ownership of the buffer through a capsule, which returns it to the pool when the last of
+// them is destroyed.
+template <typename T>
+class OwnedBuffer {
+public:
+    explicit OwnedBuffer(size_t size) : data_(quickmp::HostAllocator<T>().allocate(size)) {
+        owner_ = nb::capsule(data_, [](void *p) noexcept { quickmp::host_free(p); });
+    }
+
+    T *data() const { return data_; }
+
+    nb::object view(std::initializer_list<size_t> shape, size_t offset = 0) const {
+        return nb::ndarray<T, nb::numpy, nb::c_contig, nb::device::cpu>(data_ + offset, shape,
+                                                                       owner_)
+            .cast();
+    }
+
+private:
+    T *data_;
+    nb::capsule owner_;
+};
+
+// Output array of length size: out if the caller passed one, otherwise a new array. Returns the
+// Python object to return and the pointer to write to.
+template <typename T>
+static std::pair<nb::object, T *> output_array(nb::handle out, size_t size) {
+    if (out.is_none()) {
+        OwnedBuffer<T> buffer(size);
+        return {buffer.view({size}), buffer.data()};
+    }
+
+    pyarr_t<T> array;
+    if (!nb::try_cast(out, array, false) || array.shape(0) != size) {
+        throw std::runtime_error(std::string("out must be a C-contiguous ") + dtype_name<T>() +
+                                 " array of length " + std::to_string(size) + ".");
+    }
+    return {nb::borrow(out), array.data()};
+}
+
+// Call f with a value of the C++ type of dtype. Returns false if there is none.
+template <class F>
+static bool visit_dtype(nb::dlpack::dtype dtype, F f) {
+    if (dtype == nb::dtype<double>()) {
+        f(double());
+    } else if (dtype == nb::dtype<float>()) {
+        f(float());
+    } else if (dtype == nb::dtype<int8_t>()) {
+        f(int8_t());
+    } else if (dtype == nb::dtype<int16_t>()) {
+        f(int16_t());
+    } else if (dtype == nb::dtype<int32_t>()) {
+        f(int32_t());
+    } else if (dtype == nb::dtype<int64_t>()) {
+        f(int64_t());
+    } else if (dtype == nb::dtype<uint8_t>()) {
+        f(uint8_t());
+    } else if (dtype == nb::dtype<uint16_t>()) {
+        f(uint16_t());
+    } else if (dtype == nb::dtype<uint32_t>()) {
+        f(uint32_t());
+    } else if (dtype == nb::dtype<uint64_t>()) {
+        f(uint64_t());
+    } else if (dtype == nb::dtype<bool>()) {
+        f(bool());
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Time series passed to the kernels. C-contiguous arrays of the computed dtype are used in place.
+// Arrays of other numeric dtypes or with strides are converted by data(), which is called after
+// the GIL has been released; anything else (e.g. lists or float16 arrays) is converted by
+// nanobind up front.
+template <typename Scalar>
+class Input {
+public:
+    Input(const const_pyarr_t<Scalar> &array) : data_(array.data()), size_(array.shape(0)) {}
+
+    Input(nb::handle object) {
+        if (nb::try_cast(object, array_, false) && visit_dtype(array_.dtype(), [](auto) {})) {
+            size_ = array_.shape(0);
+            if (array_.dtype() == nb::dtype<Scalar>() && array_.stride(0) == 1) {
+                data_ = static_cast<const Scalar *>(array_.data());
+            }
+        } else {
+            converted_ = nb::cast<const_pyarr_t<Scalar>>(object);
+            data_ = converted_.data();
+            size_ = converted_.shape(0);
+        }
+    }
+
+    size_t size() const { return size_; }
+
+    const Scalar *data() {
+        if (!data_ && size_ > 0) {
+            buffer_.resize(size_);
+            int64_t stride = array_.stride(0);
+            visit_dtype(array_.dtype(), [&](auto value) {
+                using Source = decltype(value);
+                const Source *source = static_cast<const Source *>(array_.data());
+                for (size_t i = 0; i < size_; i++) {
+                    buffer_[i] = static_cast<Scalar>(source[static_cast<int64_t>(i) * stride]);
+                }
+            });
+            data_ = buffer_.data();
+        }
+        return data_;
+    }
+
+private:
+    any_pyarr_t array_;
+    const_pyarr_t<Scalar> converted_;
+    quickmp::host_vector<Scalar> buffer_;
+    const Scalar *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// True if object is a float32 array, which is computed in single precision
+static bool is_float32(nb::handle object) {
+    any_pyarr_t array;
+    return nb::try_cast(object, array, false) && array.dtype() == nb::dtype<float>();
+}
+
+// The Python functions below are registered for C-contiguous float64 and float32 arrays, which
+// are passed to the kernels as they are, followed by an overload for any other object. The latter
+// converts float32 arrays with strides to float32 and everything else to float64 without holding
+// the GIL. Results are written directly into the returned numpy arrays, or into the arrays passed
+// as out.
+
+template <typename Scalar, typename Array = const_pyarr_t<Scalar>>
+static nb::object sliding_dot_product_impl(Array T_array, Array Q_array, int stream,
+                                           nb::handle out) {
+    if (!g_initialized) {
+        throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+    }
+    Input<Scalar> T(T_array), Q(Q_array);
+    size_t n = T.size();
+    size_t m = Q.size();
+
+    auto [QT, QT_data] = output_array<Scalar>(out, n - m + 1);
+
+    {
+        nb::gil_scoped_release release;
+        quickmp::sliding_dot_product(T.data(), Q.data(), QT_data, n, m, stream);
+    }
+
+    return QT;
+}
+
+template <typename Scalar, typename Array = const_pyarr_t<Scalar>>
+static nb::object compute_mean_std_impl(Array T_array, size_t m, int stream,
+                                        std::optional<std::pair<nb::handle, nb::handle>> out) {
+    if (!g_initialized) {
+        throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+    }
+    Input<Scalar> T(T_array);
+    size_t n = T.size();
+
+    nb::handle mu_out = Py_None, sigma_out = Py_None;
+    if (out) {
+        mu_out = out->first;
+        sigma_out = out->second;
+    }
+
+    auto [mu, mu_data] = output_array<Scalar>(mu_out, n - m + 1);
+    auto [sigma, sigma_data] = output_array<Scalar>(sigma_out, n - m + 1);
+
+    {
+        nb::gil_scoped_release release;
+        quickmp::compute_mean_std(T.data(), mu_data, sigma_data, n, m, stream);
+    }
+
+    return nb::make_tuple(mu, sigma);
+}
+
+template <typename Scalar, typename Array = const_pyarr_t<Scalar>>
+static nb::object selfjoin_impl(Array T_array, size_t m, int stream, bool normalize,
+                                int num_threads, bool return_index, nb::handle out,
+                                nb::handle out_index, bool low_memory) {
+    if (!g_initialized) {
+        throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+    }
+    Input<Scalar> T(T_array);
+    size_t n = T.size();
+
+    auto [P, P_data] = output_array<Scalar>(out, n - m + 1);
+    nb::object I;
+    int64_t *I_data = nullptr;
+    if (return_index) {
+        std::tie(I, I_data) = output_array<int64_t>(out_index, n - m + 1);
+    }
+
+    {
+        nb::gil_scoped_release release;
+        if (return_index) {
+            quickmp::selfjoin(T.data(), P_data, I_data, n, m, stream, normalize, num_threads,
+                              low_memory);
+        } else {
+            quickmp::selfjoin(T.data(), P_data, n, m, stream, normalize, num_threads, low_memory);
+        }
+    }
+
+    if (return_index) {
+        return nb::make_tuple(P, I);
+    }
+    return P;
+}
+
+template <typename Scalar, typename Array = const_pyarr_t<Scalar>>
+static nb::object abjoin_impl(Array T1_array, Array T2_array, size_t m, int stream,
+                              bool normalize, bool return_index, nb::handle out,
+                              nb::handle out_index) {
+    if (!g_initialized) {
+        throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+    }
+    Input<Scalar> T1(T1_array), T2(T2_array);
+    size_t n1 = T1.size();
+    size_t n2 = T2.size();
+
+    auto [P, P_data] = output_array<Scalar>(out, n1 - m + 1);
+    nb::object I;
+    int64_t *I_data = nullptr;
+    if (return_index) {
+        std::tie(I, I_data) = output_array<int64_t>(out_index, n1 - m + 1);
+    }
+
+    {
+        nb::gil_scoped_release release;
+        if (return_index) {
+            quickmp::abjoin(T1.data(), T2.data(), P_data, I_data, n1, n2, m, stream, normalize);
+        } else {
+            quickmp::abjoin(T1.data(), T2.data(), P_data, n1, n2, m, stream, normalize);
+        }
+    }
+
+    if (return_index) {
+        return nb::make_tuple(P, I);
+    }
+    return P;
+}
+
+template <typename Scalar>
+using const_pyarr2d_t =
+    nb::ndarray<const Scalar, nb::numpy, nb::ndim<2>, nb::c_contig, nb::device::cpu>;
+
+// Time series of a batch, either the rows of a 2-D array or a list of 1-D arrays
+template <typename Scalar>
+struct Batch {
+    std::vector<const Scalar *> T;
+    std::vector<size_t> n;
+
+    explicit Batch(const_pyarr2d_t<Scalar> &T2d) {
+        for (size_t s = 0; s < T2d.shape(0); s++) {
+            T.push_back(T2d.data() + s * T2d.shape(1));
+            n.push_back(T2d.shape(1));
+        }
+    }
+
+    explicit Batch(std::vector<const_pyarr_t<Scalar>> &Ts) {
+        for (auto &Ts_s : Ts) {
+            T.push_back(Ts_s.data());
+            n.push_back(Ts_s.shape(0));
+        }
+    }
+
+    size_t size() const { return T.size(); }
+};
+
+// Output profiles of a batch, stored back to back in buffers that are handed over to numpy
+template <typename Scalar>
+struct BatchResult {
+    std::vector<size_t> offsets;
+    std::optional<OwnedBuffer<Scalar>> P;
+    std::optional<OwnedBuffer<int64_t>> I;
+    std::vector<Scalar *> P_ptrs;
+    std::vector<int64_t *> I_ptrs;
+
+    BatchResult(const std::vector<size_t> &n, size_t m, bool return_index) {
+        size_t total = 0;
+        for (size_t n_s : n) {
+            if (n_s < m) {
+                throw std::runtime_error("Every time series must be at least m long.");
+            }
+            offsets.push_back(total);
+            total += n_s - m + 1;
+        }
+        offsets.push_back(total);
+
+        P.emplace(total);
+        if (return_index) {
+            I.emplace(total);
+        }
+        for (size_t s = 0; s + 1 < offsets.size(); s++) {
+            P_ptrs.push_back(P->data() + offsets[s]);
+            if (return_index) {
+                I_ptrs.push_back(I->data() + offsets[s]);
+            }
+        }
+    }
+
+    int64_t *const *index() const { return I ? I_ptrs.data() : nullptr; }
+
+    // Profiles as a 2-D array (or tuple of arrays if return_index)
+    nb::object to_array(size_t rows, size_t l) const {
+        if (I) {
+            return nb::make_tuple(P->view({rows, l}), I->view({rows, l}));
+        }
+        return P->view({rows, l});
+    }
+
+    // Profiles as a list of 1-D arrays (or tuple of lists if return_index)
+    nb::object to_list() const {
+        nb::list P_list, I_list;
+        for (size_t s = 0; s + 1 < offsets.size(); s++) {
+            size_t l = offsets[s + 1] - offsets[s];
+            P_list.append(P->view({l}, offsets[s]));
+            if (I) {
+                I_list.append(I->view({l}, offsets[s]));
+            }
+        }
+        if (I) {
+            return nb::make_tuple(P_list, I_list);
+        }
+        return P_list;
+    }
+};
+
+template <typename Scalar>
+static void selfjoin_batch_run(const Batch<Scalar> &batch, BatchResult<Scalar> &result, size_t m,
+                               bool normalize, int num_threads) {
+    if (!g_initialized) {
+        throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+    }
+    nb::gil_scoped_release release;
+    quickmp::selfjoin_batch(batch.T.data(), result.P_ptrs.data(), result.index(), batch.n.data(),
+                            batch.size(), m, normalize, num_threads);
+}
+
+template <typename Scalar>
+static void abjoin_batch_run(const Batch<Scalar> &batch1, const Batch<Scalar> &batch2,
+                             BatchResult<Scalar> &result, size_t m, bool normalize,
+                             int num_threads) {
+    if (!g_initialized) {
+        throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+    }
+    if (batch1.size() != batch2.size()) {
+        throw std::runtime_error("T1s and T2s must contain the same number of time series.");
+    }
+    for (size_t n2 : batch2.n) {
+        if (n2 < m) {
+            throw std::runtime_error("Every time series must be at least m long.");
+        }
+    }
+    nb::gil_scoped_release release;
+    quickmp::abjoin_batch(batch1.T.data(), batch2.T.data(), result.P_ptrs.data(), result.index(),
+                          batch1.n.data(), batch2.n.data(), batch1.size(), m, normalize,
+                          num_threads);
+}
+
+template <typename Scalar>
+static nb::object selfjoin_batch_array(const_pyarr2d_t<Scalar> Ts, size_t m, bool normalize,
+                                       int num_threads, bool return_index) {
+    Batch<Scalar> batch(Ts);
+    BatchResult<Scalar> result(batch.n, m, return_index);
+    selfjoin_batch_run(batch, result, m, normalize, num_threads);
+    return result.to_array(batch.size(), Ts.shape(1) - m + 1);
+}
+
+template <typename Scalar>
+static nb::object selfjoin_batch_list(std::vector<const_pyarr_t<Scalar>> Ts, size_t m,
+                                      bool normalize, int num_threads, bool return_index) {
+    Batch<Scalar> batch(Ts);
+    BatchResult<Scalar> result(batch.n, m, return_index);
+    selfjoin_batch_run(batch, result, m, normalize, num_threads);
+    return result.to_list();
+}
+
+template <typename Scalar>
+static nb::object abjoin_batch_array(const_pyarr2d_t<Scalar> T1s, const_pyarr2d_t<Scalar> T2s,
+                                     size_t m, bool normalize, int num_threads,
+                                     bool return_index) {
+    Batch<Scalar> batch1(T1s), batch2(T2s);
+    BatchResult<Scalar> result(batch1.n, m, return_index);
+    abjoin_batch_run(batch1, batch2, result, m, normalize, num_threads);
+    return result.to_array(batch1.size(), T1s.shape(1) - m + 1);
+}
+
+template <typename Scalar>
+static nb::object abjoin_batch_list(std::vector<const_pyarr_t<Scalar>> T1s,
+                                    std::vector<const_pyarr_t<Scalar>> T2s, size_t m,
+                                    bool normalize, int num_threads, bool return_index) {
+    Batch<Scalar> batch1(T1s), batch2(T2s);
+    BatchResult<Scalar> result(batch1.n, m, return_index);
+    abjoin_batch_run(batch1, batch2, result, m, normalize, num_threads);
+    return result.to_list();
+}
+
+// Path of a str or os.PathLike object
+static std::string fspath(nb::handle path) {
+    return nb::cast<std::string>(nb::module_::import_("os").attr("fspath")(path));
+}
+
+static void selfjoin_file_impl(nb::handle input, nb::handle output, size_t m,
+                               nb::handle output_index, bool normalize, int num_threads,
+                               size_t memory_budget) {
+    if (!g_initialized) {
+        throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+    }
+    std::string input_path = fspath(input);
+    std::string output_path = fspath(output);
+    std::string index_path = output_index.is_none() ? "" : fspath(output_index);
+
+    nb::gil_scoped_release release;
+    quickmp::selfjoin_file(input_path.c_str(), output_path.c_str(),
+                           output_index.is_none() ? nullptr : index_path.c_str(), m, normalize,
+                           num_threads, memory_budget);
+}
+
+static void abjoin_file_impl(nb::handle input1, nb::handle input2, nb::handle output, size_t m,
+                             nb::handle output_index, bool normalize, int num_threads,
+                             size_t memory_budget) {
+    if (!g_initialized) {
+        throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+    }
+    std::string input1_path = fspath(input1);
+    std::string input2_path = fspath(input2);
+    std::string output_path = fspath(output);
+    std::string index_path = output_index.is_none() ? "" : fspath(output_index);
+
+    nb::gil_scoped_release release;
+    quickmp::abjoin_file(input1_path.c_str(), input2_path.c_str(), output_path.c_str(),
+                         output_index.is_none() ? nullptr : index_path.c_str(), m, normalize,
+                         num_threads, memory_budget);
+}
+
+static nb::object selfjoin_tile_impl(nb::handle T_array, size_t m, std::pair<size_t, size_t> rows,
+                                     std::pair<size_t, size_t> cols, bool normalize,
+                                     int num_threads, bool return_cols) {
+    if (!g_initialized) {
+        throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+    }
+    Input<double> T(T_array);
+    size_t num_rows = rows.second > rows.first ? rows.second - rows.first : 0;
+    size_t num_cols = return_cols && cols.second > cols.first ? cols.second - cols.first : 0;
+
+    OwnedBuffer<double> P_row(num_rows), P_col(num_cols);
+    OwnedBuffer<int64_t> I_row(num_rows), I_col(num_cols);
+
+    {
+        nb::gil_scoped_release release;
+        quickmp::selfjoin_tile(T.data(), T.size(), m, rows.first, rows.second, cols.first,
+                               cols.second, P_row.data(), I_row.data(),
+                               return_cols ? P_col.data() : nullptr,
+                               return_cols ? I_col.data() : nullptr, normalize, num_threads);
+    }
+
+    if (return_cols) {
+        return nb::make_tuple(P_row.view({num_rows}), I_row.view({num_rows}),
+                              P_col.view({num_cols}), I_col.view({num_cols}));
+    }
+    return nb::make_tuple(P_row.view({num_rows}), I_row.view({num_rows}));
+}
+
+static void merge_profiles_impl(pyarr_t<double> P, index_pyarr_t I, const_pyarr_t<double> P_other,
+                                const_pyarr_t<int64_t> I_other) {
+    if (!g_initialized) {
+        throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+    }
+    size_t n = P.shape(0);
+    if (I.shape(0) != n || P_other.shape(0) != n || I_other.shape(0) != n) {
+        throw std::runtime_error("Profiles to merge must have the same length.");
+    }
+
+    nb::gil_scoped_release release;
+    quickmp::merge_profiles(P.data(), I.data(), P_other.data(), I_other.data(), n);
+}
+
+template <typename Scalar>
+using topk_t = std::vector<std::tuple<int64_t, int64_t, Scalar>>;
+
+template <typename Scalar, typename Array>
+static topk_t<Scalar> topk_impl(Array T_array, size_t m, size_t k, bool discords, int stream,
+                                bool normalize, int num_threads) {
+    if (!g_initialized) {
+        throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+    }
+    Input<Scalar> T(T_array);
+    size_t n = T.size();
+    std::vector<int64_t> index(k), neighbor(k);
+    std::vector<Scalar> distance(k);
+    size_t found;
+
+    {
+        nb::gil_scoped_release release;
+        if (discords) {
+            found = quickmp::topk_discords(T.data(), n, m, k, index.data(), neighbor.data(),
+                                           distance.data(), stream, normalize, num_threads);
+        } else {
+            found = quickmp::topk_motifs(T.data(), n, m, k, index.data(), neighbor.data(),
+                                         distance.data(), stream, normalize, num_threads);
+        }
+    }
+
+    topk_t<Scalar> result;
+    for (size_t i = 0; i < found; i++) {
+        result.emplace_back(index[i], neighbor[i], distance[i]);
+    }
+    return result;
+}
+
+template <typename Scalar>
+static topk_t<Scalar> topk_motifs_impl(const_pyarr_t<Scalar> T, size_t m, size_t k, int stream,
+                                       bool normalize, int num_threads) {
+    return topk_impl<Scalar>(T, m, k, false, stream, normalize, num_threads);
+}
+
+template <typename Scalar>
+static topk_t<Scalar> topk_discords_impl(const_pyarr_t<Scalar> T, size_t m, size_t k, int stream,
+                                         bool normalize, int num_threads) {
+    return topk_impl<Scalar>(T, m, k, true, stream, normalize, num_threads);
+}
+
+static nb::object sliding_dot_product_any(nb::handle T, nb::handle Q, int stream,
+                                          nb::handle out) {
+    if (is_float32(T) && is_float32(Q)) {
+        return sliding_dot_product_impl<float, nb::handle>(T, Q, stream, out);
+    }
+    return sliding_dot_product_impl<double, nb::handle>(T, Q, stream, out);
+}
+
+static nb::object compute_mean_std_any(nb::handle T, size_t m, int stream,
+                                       std::optional<std::pair<nb::handle, nb::handle>> out) {
+    if (is_float32(T)) {
+        return compute_mean_std_impl<float, nb::handle>(T, m, stream, out);
+    }
+    return compute_mean_std_impl<double, nb::handle>(T, m, stream, out);
+}
+
+static nb::object selfjoin_any(nb::handle T, size_t m, int stream, bool normalize,
+                               int num_threads, bool return_index, nb::handle out,
+                               nb::handle out_index, bool low_memory) {
+    if (is_float32(T)) {
+        return selfjoin_impl<float, nb::handle>(T, m, stream, normalize, num_threads,
+                                                return_index, out, out_index, low_memory);
+    }
+    return selfjoin_impl<double, nb::handle>(T, m, stream, normalize, num_threads, return_index,
+                                             out, out_index, low_memory);
+}
+
+static nb::object abjoin_any(nb::handle T1, nb::handle T2, size_t m, int stream, bool normalize,
+                             bool return_index, nb::handle out, nb::handle out_index) {
+    if (is_float32(T1) && is_float32(T2)) {
+        return abjoin_impl<float, nb::handle>(T1, T2, m, stream, normalize, return_index, out,
+                                              out_index);
+    }
+    return abjoin_impl<double, nb::handle>(T1, T2, m, stream, normalize, return_index, out,
+                                           out_index);
+}
+
+// Result of an operation submitted to a stream. It keeps the inputs and outputs of the operation
+// alive until the operation is complete, and waits for it when it is destroyed before that.
+class AsyncResult {
+public:
+    AsyncResult(nb::object result, std::shared_ptr<void> inputs)
+        : result_(std::move(result)), inputs_(std::move(inputs)) {}
+
+    ~AsyncResult() {
+        if (!event_.query()) {
+            nb::gil_scoped_release release;
+            try {
+                event_.synchronize();
+            } catch (const std::exception &) {
+            }
+        }
+    }
+
+    quickmp::Event &event() { return event_; }
+
+    bool done() const { return event_.query(); }
+
+    nb::object result() {
+        {
+            nb::gil_scoped_release release;
+            event_.synchronize();
+        }
+        return result_;
+    }
+
+    // Call fn with self once the operation is complete. fn is called from the worker thread of
+    // the stream with the GIL held, or right away if the operation already is complete.
+    void add_done_callback(nb::handle self, nb::object fn) {
+        // Freed by the callback, which holds the GIL to do so
+        auto *args = new std::pair<nb::object, nb::object>(std::move(fn), nb::borrow(self));
+        event_.add_callback([args] {
+            nb::gil_scoped_acquire acquire;
+            std::unique_ptr<std::pair<nb::object, nb::object>> owned(args);
+            try {
+                owned->first(owned->second);
+            } catch (nb::python_error &e) {
+                e.discard_as_unraisable("quickmp.AsyncResult done callback");
+            }
+        });
+    }
+
+    // Awaitable completed through the running event loop, so that awaiting does not block it
+    nb::object awaitable(nb::handle self) {
+        nb::object loop = nb::module_::import_("asyncio").attr("get_running_loop")();
+        nb::object future = loop.attr("create_future")();
+
+        nb::object resolve = nb::cpp_function([future](AsyncResult &async) {
+            if (nb::cast<bool>(future.attr("cancelled")())) {
+                return;
+            }
+            try {
+                future.attr("set_result")(async.result());
+            } catch (nb::python_error &e) {
+                future.attr("set_exception")(e.value());
+            } catch (const std::exception &e) {
+                future.attr("set_exception")(nb::handle(PyExc_RuntimeError)(e.what()));
+            }
+        });
+        add_done_callback(self, nb::cpp_function([loop, resolve](nb::handle async) {
+            loop.attr("call_soon_threadsafe")(resolve, async);
+        }));
+
+        return future.attr("__await__")();
+    }
+
+private:
+    nb::object result_;
+    std::shared_ptr<void> inputs_;
+    quickmp::Event event_;
+};
+
+// Submit op to stream and return an AsyncResult holding result and inputs, completed by op
+template <class Op>
+static AsyncResult *submit(int stream, nb::object result, std::shared_ptr<void> inputs, Op op) {
+    std::unique_ptr<AsyncResult> async(new AsyncResult(std::move(result), std::move(inputs)));
+    {
+        nb::gil_scoped_release release;
+        op();
+        async->event().record(stream);
+    }
+    return async.release();
+}
+
+template <typename Scalar>
+static AsyncResult *selfjoin_async_impl(nb::handle T_array, size_t m, int stream, bool normalize,
+                                        int num_threads, bool return_index) {
+    if (!g_initialized) {
+        throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+    }
+    auto T = std::make_shared<Input<Scalar>>(T_array);
+    size_t n = T->size();
+    if (m == 0 || n < m) {
+        throw std::runtime_error("Time series must be at least as long as the window size.");
+    }
+    size_t l = n - m + 1;
+
+    OwnedBuffer<Scalar> P(l);
+    std::optional<OwnedBuffer<int64_t>> I;
+    if (return_index) {
+        I.emplace(l);
+    }
+    nb::object result = return_index ? nb::object(nb::make_tuple(P.view({l}), I->view({l})))
+                                     : P.view({l});
+
+    return submit(stream, result, T, [&] {
+        quickmp::selfjoin_async(T->data(), P.data(), I ? I->data() : nullptr, n, m, stream,
+                                normalize, num_threads);
+    });
+}
+
+template <typename Scalar>
+static AsyncResult *abjoin_async_impl(nb::handle T1_array, nb::handle T2_array, size_t m,
+                                      int stream, bool normalize, bool return_index) {
+    if (!g_initialized) {
+        throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+    }
+    auto T = std::make_shared<std::pair<Input<Scalar>, Input<Scalar>>>(T1_array, T2_array);
+    size_t n1 = T->first.size();
+    size_t n2 = T->second.size();
+    if (m == 0 || n1 < m || n2 < m) {
+        throw std::runtime_error("Time series must be at least as long as the window size.");
+    }
+    size_t l = n1 - m + 1;
+
+    OwnedBuffer<Scalar> P(l);
+    std::optional<OwnedBuffer<int64_t>> I;
+    if (return_index) {
+        I.emplace(l);
+    }
+    nb::object result = return_index ? nb::object(nb::make_tuple(P.view({l}), I->view({l})))
+                                     : P.view({l});
+
+    return submit(stream, result, T, [&] {
+        quickmp::abjoin_async(T->first.data(), T->second.data(), P.data(),
+                              I ? I->data() : nullptr, n1, n2, m, stream, normalize);
+    });
+}
+
+static AsyncResult *selfjoin_async_any(nb::handle T, size_t m, int stream, bool normalize,
+                                       int num_threads, bool return_index) {
+    if (is_float32(T)) {
+        return selfjoin_async_impl<float>(T, m, stream, normalize, num_threads, return_index);
+    }
+    return selfjoin_async_impl<double>(T, m, stream, normalize, num_threads, return_index);
+}
+
+static AsyncResult *abjoin_async_any(nb::handle T1, nb::handle T2, size_t m, int stream,
+                                     bool normalize, bool return_index) {
+    if (is_float32(T1) && is_float32(T2)) {
+        return abjoin_async_impl<float>(T1, T2, m, stream, normalize, return_index);
+    }
+    return abjoin_async_impl<double>(T1, T2, m, stream, normalize, return_index);
+}
+
+static nb::object topk_any(nb::handle T, size_t m, size_t k, bool discords, int stream,
+                           bool normalize, int num_threads) {
+    if (is_float32(T)) {
+        return nb::cast(topk_impl<float>(T, m, k, discords, stream, normalize, num_threads));
+    }
+    return nb::cast(topk_impl<double>(T, m, k, discords, stream, normalize, num_threads));
+}
+
+static nb::object topk_motifs_any(nb::handle T, size_t m, size_t k, int stream, bool normalize,
+                                  int num_threads) {
+    return topk_any(T, m, k, false, stream, normalize, num_threads);
+}
+
+static nb::object topk_discords_any(nb::handle T, size_t m, size_t k, int stream,
+                                    bool normalize, int num_threads) {
+    return topk_any(T, m, k, true, stream, normalize, num_threads);
+}
+
+// Plan whose calls to execute() are serialized by a mutex (only taken with the GIL released)
+struct PyPlan : quickmp::Plan {
+    using quickmp::Plan::Plan;
+
+    std::mutex mutex;
+};
+
+// StreamingSelfJoin whose calls are serialized by a mutex (only taken with the GIL released)
+struct PyStreamingSelfJoin : quickmp::StreamingSelfJoin {
+    using quickmp::StreamingSelfJoin::StreamingSelfJoin;
+
+    std::mutex mutex;
+
+    void append(const double *values, size_t count) {
+        nb::gil_scoped_release release;
+        std::lock_guard<std::mutex> lock(mutex);
+        quickmp::StreamingSelfJoin::append(values, count);
+    }
+
+    // Run copy() with the mutex and the GIL held
+    template <class F>
+    nb::object locked_copy(F copy) {
+        nb::gil_scoped_release release;
+        std::lock_guard<std::mutex> lock(mutex);
+        nb::gil_scoped_acquire acquire;
+        return copy();
+    }
+};
+
+// AnytimeSelfJoin whose calls are serialized by a mutex (only taken with the GIL released)
+struct PyAnytimeSelfJoin : quickmp::AnytimeSelfJoin {
+    using quickmp::AnytimeSelfJoin::AnytimeSelfJoin;
+
+    std::mutex mutex;
+
+    // Run read() with the mutex held
+    template <class F>
+    auto locked(F read) {
+        nb::gil_scoped_release release;
+        std::lock_guard<std::mutex> lock(mutex);
+        return read();
+    }
+
+    // Run copy() with the mutex and the GIL held
+    template <class F>
+    nb::object locked_copy(F copy) {
+        nb::gil_scoped_release release;
+        std::lock_guard<std::mutex> lock(mutex);
+        nb::gil_scoped_acquire acquire;
+        return copy();
+    }
+};
+
+NB_MODULE(_quickmp, m, nb::gil_not_used()) {
     m.doc() = "Quickly compute matrix profiles";
 
     m.def(
         "initialize",
-        []() {
+        [](bool huge_pages, bool numa_local, int cpu_devices,
+           std::optional<std::string> backend, std::optional<std::string> affinity,
+           std::optional<std::vector<int>> cpus) {
+            nb::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(g_init_mutex);
             if (g_initialized) {
                 throw std::runtime_error("quickmp already initialized. Call finalize() first.");
             }
-            quickmp::initialize();
+            quickmp::InitOptions options;
+            options.huge_pages = huge_pages;
+            options.numa_local = numa_local;
+            options.cpu_devices = cpu_devices;
+            options.backend = backend.value_or("");
+            options.affinity = affinity.value_or("");
+            options.cpus = cpus.value_or(std::vector<int>());
+            quickmp::initialize(options);
             g_initialized = true;
         },
+        "huge_pages"_a = false, "numa_local"_a = false, "cpu_devices"_a = 1,
+        "backend"_a = nb::none(), "affinity"_a = nb::none(), "cpus"_a = nb::none(),
         R"doc(
         Initialize the quickmp backend.
 
         Initializes all available devices and selects device 0.
+
+        Args:
+          huge_pages: Back host buffers of 2 MB or more with huge pages to reduce TLB misses
+            (default: False). Linux only.
+          numa_local: Place host buffers of 2 MB or more on the NUMA node of the thread that
+            allocates them (default: False). Linux only.
+          cpu_devices: Split the CPU cores into this many virtual devices, each with its own
+            streams and thread pool, to develop multi-device code without VE hardware
+            (default: 1). Only used for CPU backend.
+          backend: Backend to run the kernels with, one of list_backends() (default: None, use
+            the QUICKMP_BACKEND environment variable or else the default backend)
+          affinity: Pin quickmp's native worker threads to CPUs: "compact" fills the cores of
+            one socket before the next, "scatter" alternates between sockets (default: None,
+            leave placement to the OS). Pinned workers also keep their buffers of 2 MB or more
+            on their own NUMA node. Only used for CPU backend, Linux only.
+          cpus: Explicit list of CPUs to pin the worker threads to in order, instead of a
+            policy (default: None). The streams and thread pools are sized after the list if
+            it is shorter than usable_cpus. Only used for CPU backend, Linux only.
     )doc");
 
     m.def(
         "finalize",
         []() {
+            // Workers may need the GIL to run the done callbacks of pending operations
+            nb::gil_scoped_release release;
+            std::lock_guard<std::mutex> lock(g_init_mutex);
             if (!g_initialized) {
                 throw std::runtime_error("quickmp not initialized.");
             }
@@ -47,6 +900,32 @@ NB_MODULE(_quickmp, m) {
         Finalize the quickmp backend.
     )doc");
 
+    m.def("list_backends", &quickmp::list_backends, R"doc(
+        Get the names of the backends that can be passed to initialize().
+
+        On the CPU build, "cpu" uses the widest instruction set supported by the CPU, while
+        "cpu-generic", "cpu-avx2" and "cpu-avx512" force one. Only backends supported by the CPU
+        are listed. The VE build has the single backend "ve".
+
+        Returns:
+          List of backend names
+    )doc");
+
+    m.def(
+        "get_backend",
+        []() {
+            if (!g_initialized) {
+                throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+            }
+            return quickmp::get_backend();
+        },
+        R"doc(
+        Get the name of the backend selected by initialize().
+
+        Returns:
+          Backend name
+    )doc");
+
     m.def(
         "get_device_count",
         []() {
@@ -59,7 +938,8 @@ NB_MODULE(_quickmp, m) {
         Get the number of available devices.
 
         Returns:
-          Number of available devices (VE: number of VE devices, CPU: always 1)
+          Number of available devices (VE: number of VE devices, CPU: cpu_devices passed to
+          initialize())
     )doc");
 
     m.def(
@@ -95,126 +975,749 @@ NB_MODULE(_quickmp, m) {
 
     m.def(
         "sliding_dot_product",
-        [](const_pyarr_t T, const_pyarr_t Q, int stream) {
-            if (!g_initialized) {
-                throw std::runtime_error("quickmp not initialized. Call initialize() first.");
-            }
-            size_t n = T.shape(0);
-            size_t m = Q.shape(0);
-
-            std::vector<double> QT(n - m + 1);
-
-            {
-                nb::gil_scoped_release release;
-                quickmp::sliding_dot_product(T.data(), Q.data(), QT.data(), n, m, stream);
-            }
-
-            return pyarr_t(QT.data(), {QT.size()}).cast();
-        },
-        "T"_a, "Q"_a, "stream"_a = 0,
+        &sliding_dot_product_impl<double>,
+        "T"_a, "Q"_a, "stream"_a = 0, "out"_a = nb::none(),
         R"doc(
         Compute the sliding dot product between time series T and Q.
 
         Args:
           T: Time series
           Q: Time series
-          stream: Stream number (default: 0). Only used for VE backend.
+          stream: Stream number (default: 0). Runs after the operations submitted to it before.
+          out: Array to write the result to instead of allocating a new one (default: None).
+            Must be C-contiguous with the dtype and length of the result.
 
         Returns:
           Sliding dot product
     )doc");
+    m.def("sliding_dot_product", &sliding_dot_product_impl<float>, "T"_a, "Q"_a,
+          "stream"_a = 0, "out"_a = nb::none());
+    m.def("sliding_dot_product", &sliding_dot_product_any, "T"_a, "Q"_a, "stream"_a = 0,
+          "out"_a = nb::none());
 
     m.def(
         "compute_mean_std",
-        [](const_pyarr_t T, size_t m, int stream) {
-            if (!g_initialized) {
-                throw std::runtime_error("quickmp not initialized. Call initialize() first.");
-            }
-            size_t n = T.shape(0);
-            std::vector<double> mu(n - m + 1);
-            std::vector<double> sigma(n - m + 1);
-
-            {
-                nb::gil_scoped_release release;
-                quickmp::compute_mean_std(T.data(), mu.data(), sigma.data(), n, m, stream);
-            }
-
-            return std::make_pair(pyarr_t(mu.data(), {mu.size()}).cast(),
-                                  pyarr_t(sigma.data(), {sigma.size()}).cast());
-        },
-        "T"_a, "m"_a, "stream"_a = 0,
+        &compute_mean_std_impl<double>,
+        "T"_a, "m"_a, "stream"_a = 0, "out"_a = nb::none(),
         R"doc(
         Compute the mean and standard deviation of every subsequence in time series T.
 
         Args:
           T: Time series
           m: Window size
-          stream: Stream number (default: 0). Only used for VE backend.
+          stream: Stream number (default: 0). Runs after the operations submitted to it before.
+          out: Tuple of arrays to write the mean and standard deviation to instead of
+            allocating new ones (default: None). Either may be None.
 
         Returns:
           Tuple of mean and standard deviation
     )doc");
+    m.def("compute_mean_std", &compute_mean_std_impl<float>, "T"_a, "m"_a, "stream"_a = 0,
+          "out"_a = nb::none());
+    m.def("compute_mean_std", &compute_mean_std_any, "T"_a, "m"_a, "stream"_a = 0,
+          "out"_a = nb::none());
 
     m.def(
         "selfjoin",
-        [](const_pyarr_t T, size_t m, int stream, bool normalize) {
-            if (!g_initialized) {
-                throw std::runtime_error("quickmp not initialized. Call initialize() first.");
-            }
-            size_t n = T.shape(0);
-            std::vector<double> P(n - m + 1);
-
-            {
-                nb::gil_scoped_release release;
-                quickmp::selfjoin(T.data(), P.data(), n, m, stream, normalize);
-            }
-
-            return pyarr_t(P.data(), {P.size()}).cast();
-        },
-        "T"_a, "m"_a, "stream"_a = 0, "normalize"_a = true,
+        &selfjoin_impl<double>,
+        "T"_a, "m"_a, "stream"_a = 0, "normalize"_a = true, "num_threads"_a = 1,
+        "return_index"_a = false, "out"_a = nb::none(), "out_index"_a = nb::none(),
+        "low_memory"_a = false,
         R"doc(
         Compute the matrix profile for time series T.
 
+        float32 arrays are computed in single precision and return float32 results; other
+        dtypes are converted to float64. Integer arrays and strided views (e.g. columns of a
+        2-D array) are converted natively after releasing the GIL.
+
         Args:
           T: Time series
           m: Window size
-          stream: Stream number (default: 0). Only used for VE backend.
+          stream: Stream number (default: 0). Runs after the operations submitted to it before.
           normalize: If True (default), use Z-normalized Euclidean distance. If False, use raw Euclidean distance.
+          num_threads: Number of threads to split a single computation across (default: 1).
+            0 uses all available cores. Only used for CPU backend.
+          return_index: If True, also return the matrix profile index (default: False).
+            Only supported by CPU backend.
+          out: Array to write the matrix profile to instead of allocating a new one
+            (default: None). Must be C-contiguous with the dtype and length of the result.
+          out_index: int64 array to write the matrix profile index to (default: None)
+          low_memory: If True, use about half the memory of the default (default: False).
+            Keeps only about 1.5 arrays of the length of T besides T and the result, and no
+            per-thread copies of the result. In float64, squared distances may differ by up to
+            about 2.4e-7 * m. Only used for CPU backend.
 
         Returns:
-          Matrix profile
+          Matrix profile, or tuple of matrix profile and matrix profile index (int64) if
+          return_index is True
     )doc");
+    m.def("selfjoin", &selfjoin_impl<float>, "T"_a, "m"_a, "stream"_a = 0, "normalize"_a = true,
+          "num_threads"_a = 1, "return_index"_a = false, "out"_a = nb::none(),
+          "out_index"_a = nb::none(), "low_memory"_a = false);
+    m.def("selfjoin", &selfjoin_any, "T"_a, "m"_a, "stream"_a = 0, "normalize"_a = true,
+          "num_threads"_a = 1, "return_index"_a = false, "out"_a = nb::none(),
+          "out_index"_a = nb::none(), "low_memory"_a = false);
 
     m.def(
         "abjoin",
-        [](const_pyarr_t T1, const_pyarr_t T2, size_t m, int stream, bool normalize) {
+        &abjoin_impl<double>,
+        "T1"_a, "T2"_a, "m"_a, "stream"_a = 0, "normalize"_a = true, "return_index"_a = false,
+        "out"_a = nb::none(), "out_index"_a = nb::none(),
+        R"doc(
+        Compute the matrix profile between time series T1 and T2.
+
+        float32 arrays are computed in single precision and return float32 results; other
+        dtypes are converted to float64. Integer arrays and strided views (e.g. columns of a
+        2-D array) are converted natively after releasing the GIL.
+
+        Args:
+          T1: Time series
+          T2: Time series
+          m: Window size
+          stream: Stream number (default: 0). Runs after the operations submitted to it before.
+          normalize: If True (default), use Z-normalized Euclidean distance. If False, use raw Euclidean distance.
+          return_index: If True, also return the index of the nearest neighbor in T2 of each
+            subsequence in T1 (default: False). Only supported by CPU backend.
+          out: Array to write the matrix profile to instead of allocating a new one
+            (default: None). Must be C-contiguous with the dtype and length of the result.
+          out_index: int64 array to write the matrix profile index to (default: None)
+
+        Returns:
+          Matrix profile, or tuple of matrix profile and matrix profile index (int64) if
+          return_index is True
+    )doc");
+    m.def("abjoin", &abjoin_impl<float>, "T1"_a, "T2"_a, "m"_a, "stream"_a = 0,
+          "normalize"_a = true, "return_index"_a = false, "out"_a = nb::none(),
+          "out_index"_a = nb::none());
+    m.def("abjoin", &abjoin_any, "T1"_a, "T2"_a, "m"_a, "stream"_a = 0, "normalize"_a = true,
+          "return_index"_a = false, "out"_a = nb::none(), "out_index"_a = nb::none());
+
+    nb::class_<AsyncResult>(m, "AsyncResult", R"doc(
+        Result of an operation submitted to a stream.
+
+        Holds references to the input arrays until the operation is complete. Dropping it
+        before then waits for the operation. AsyncResult is awaitable from asyncio coroutines.
+    )doc")
+        .def("done", &AsyncResult::done, "Return True if the operation is complete.")
+        .def(
+            "add_done_callback",
+            [](nb::handle self, nb::object fn) {
+                nb::cast<AsyncResult &>(self).add_done_callback(self, std::move(fn));
+            },
+            "fn"_a,
+            R"doc(
+            Call fn with this AsyncResult once the operation is complete.
+
+            fn is called from the native worker thread of the stream, or right away if the
+            operation already is complete. It must not block on operations of the stream.
+            Exceptions raised by fn are reported as unraisable.
+
+            Args:
+              fn: Callable taking the AsyncResult
+        )doc")
+        .def(
+            "__await__",
+            [](nb::handle self) { return nb::cast<AsyncResult &>(self).awaitable(self); },
+            R"doc(
+            Wait for the operation in the running asyncio event loop.
+
+            Completion is signaled from the native worker thread to the loop, so any number of
+            operations can be awaited concurrently from a single Python thread.
+        )doc")
+        .def("result", &AsyncResult::result,
+             R"doc(
+            Wait until the operation is complete and return its result.
+
+            Raises the exception of the operation, or of an earlier operation of the same stream,
+            if one failed.
+        )doc");
+
+    m.def(
+        "selfjoin_async",
+        &selfjoin_async_any,
+        "T"_a, "m"_a, "stream"_a = 0, "normalize"_a = true, "num_threads"_a = 1,
+        "return_index"_a = false, nb::rv_policy::take_ownership,
+        R"doc(
+        Submit a self-join to a stream without waiting for it.
+
+        Operations submitted to the same stream run one after another in submission order,
+        concurrently with the caller and with other streams. On the CPU backend, every stream is
+        served by its own worker thread. On the VE backend, the call returns once the operation
+        is complete. T must not be modified until the operation is complete.
+
+        Args:
+          T: Time series
+          m: Window size
+          stream: Stream number in [0, get_stream_count()) (default: 0)
+          normalize: If True (default), use Z-normalized Euclidean distance. If False, use raw Euclidean distance.
+          num_threads: Number of threads to split the computation across (default: 1).
+            0 uses all available cores. Ignored for VE backend.
+          return_index: If True, the result also includes the matrix profile index (default:
+            False)
+
+        Returns:
+          AsyncResult whose result() is the matrix profile, or a tuple of matrix profile and
+          matrix profile index if return_index is True
+    )doc");
+
+    m.def(
+        "abjoin_async",
+        &abjoin_async_any,
+        "T1"_a, "T2"_a, "m"_a, "stream"_a = 0, "normalize"_a = true, "return_index"_a = false,
+        nb::rv_policy::take_ownership,
+        R"doc(
+        Submit an AB-join to a stream without waiting for it. See selfjoin_async.
+
+        Args:
+          T1: First time series
+          T2: Second time series
+          m: Window size
+          stream: Stream number in [0, get_stream_count()) (default: 0)
+          normalize: If True (default), use Z-normalized Euclidean distance. If False, use raw Euclidean distance.
+          return_index: If True, the result also includes the matrix profile index (default:
+            False)
+
+        Returns:
+          AsyncResult whose result() is the matrix profile, or a tuple of matrix profile and
+          matrix profile index if return_index is True
+    )doc");
+
+    m.def(
+        "stream_synchronize",
+        [](int stream) {
             if (!g_initialized) {
                 throw std::runtime_error("quickmp not initialized. Call initialize() first.");
             }
-            size_t n1 = T1.shape(0);
-            size_t n2 = T2.shape(0);
-            std::vector<double> P(n1 - m + 1);
+            nb::gil_scoped_release release;
+            quickmp::stream_synchronize(stream);
+        },
+        "stream"_a = 0,
+        R"doc(
+        Wait until all operations submitted to a stream are complete.
 
-            {
+        Raises the first exception raised by one of them since the last call.
+
+        Args:
+          stream: Stream number (default: 0)
+    )doc");
+
+    nb::class_<quickmp::Event>(m, "Event", R"doc(
+        Marker in a stream, complete once the operations submitted to the stream before it are.
+
+        Events let a stream wait for another one (see stream_wait_event), or the caller wait for
+        part of the work submitted to a stream.
+    )doc")
+        .def(nb::init<>())
+        .def(
+            "record",
+            [](quickmp::Event &self, int stream) {
+                if (!g_initialized) {
+                    throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+                }
+                self.record(stream);
+            },
+            "stream"_a = 0,
+            R"doc(
+            Capture the operations submitted to a stream so far.
+
+            Args:
+              stream: Stream number (default: 0)
+        )doc")
+        .def("query", &quickmp::Event::query,
+             "Return True if the captured operations are complete (or nothing was recorded).")
+        .def(
+            "synchronize",
+            [](quickmp::Event &self) {
                 nb::gil_scoped_release release;
-                quickmp::abjoin(T1.data(), T2.data(), P.data(), n1, n2, m, stream, normalize);
-            }
+                self.synchronize();
+            },
+            "Wait until the captured operations are complete.");
 
-            return pyarr_t(P.data(), {P.size()}).cast();
+    m.def(
+        "stream_wait_event",
+        [](int stream, const quickmp::Event &event) {
+            if (!g_initialized) {
+                throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+            }
+            quickmp::stream_wait_event(stream, event);
         },
-        "T1"_a, "T2"_a, "m"_a, "stream"_a = 0, "normalize"_a = true,
+        "stream"_a, "event"_a,
         R"doc(
-        Compute the matrix profile between time series T1 and T2.
+        Make operations submitted to a stream from now on wait for an event, without blocking
+        the caller.
 
         Args:
-          T1: Time series
-          T2: Time series
+          stream: Stream number
+          event: Event recorded on another stream
+    )doc");
+
+    m.def(
+        "selfjoin_batch",
+        &selfjoin_batch_array<double>,
+        "Ts"_a, "m"_a, "normalize"_a = true, "num_threads"_a = 0, "return_index"_a = false,
+        R"doc(
+        Compute the matrix profiles of many time series in a single call.
+
+        The time series are scheduled across threads natively, longest first, and every thread
+        reuses its scratch buffers from one time series to the next. float32 inputs are
+        computed in single precision.
+
+        Args:
+          Ts: 2-D array with one time series per row, or list of 1-D arrays of any length
           m: Window size
-          stream: Stream number (default: 0). Only used for VE backend.
           normalize: If True (default), use Z-normalized Euclidean distance. If False, use raw Euclidean distance.
+          num_threads: Number of threads to schedule the time series across (default: 0, all
+            available cores). Only used for CPU backend; VE computes them one after another.
+          return_index: If True, also return the matrix profile indices (default: False).
+            Only supported by CPU backend.
+
+        Returns:
+          Matrix profiles as a 2-D array if Ts is a 2-D array, otherwise as a list of arrays.
+          If return_index is True, a tuple of matrix profiles and matrix profile indices.
+    )doc");
+    m.def("selfjoin_batch", &selfjoin_batch_array<float>, "Ts"_a, "m"_a, "normalize"_a = true,
+          "num_threads"_a = 0, "return_index"_a = false);
+    m.def("selfjoin_batch", &selfjoin_batch_list<double>, "Ts"_a, "m"_a, "normalize"_a = true,
+          "num_threads"_a = 0, "return_index"_a = false);
+    m.def("selfjoin_batch", &selfjoin_batch_list<float>, "Ts"_a, "m"_a, "normalize"_a = true,
+          "num_threads"_a = 0, "return_index"_a = false);
+
+    m.def(
+        "abjoin_batch",
+        &abjoin_batch_array<double>,
+        "T1s"_a, "T2s"_a, "m"_a, "normalize"_a = true, "num_threads"_a = 0,
+        "return_index"_a = false,
+        R"doc(
+        Compute the matrix profiles between many pairs of time series in a single call.
+
+        The i-th matrix profile is the one between T1s[i] and T2s[i]. Scheduling is the same as
+        for selfjoin_batch.
+
+        Args:
+          T1s: 2-D array with one time series per row, or list of 1-D arrays of any length
+          T2s: Same as T1s, with the same number of time series
+          m: Window size
+          normalize: If True (default), use Z-normalized Euclidean distance. If False, use raw Euclidean distance.
+          num_threads: Number of threads to schedule the pairs across (default: 0, all
+            available cores). Only used for CPU backend; VE computes them one after another.
+          return_index: If True, also return the matrix profile indices (default: False).
+            Only supported by CPU backend.
+
+        Returns:
+          Matrix profiles as a 2-D array if T1s is a 2-D array, otherwise as a list of arrays.
+          If return_index is True, a tuple of matrix profiles and matrix profile indices.
+    )doc");
+    m.def("abjoin_batch", &abjoin_batch_array<float>, "T1s"_a, "T2s"_a, "m"_a,
+          "normalize"_a = true, "num_threads"_a = 0, "return_index"_a = false);
+    m.def("abjoin_batch", &abjoin_batch_list<double>, "T1s"_a, "T2s"_a, "m"_a,
+          "normalize"_a = true, "num_threads"_a = 0, "return_index"_a = false);
+    m.def("abjoin_batch", &abjoin_batch_list<float>, "T1s"_a, "T2s"_a, "m"_a,
+          "normalize"_a = true, "num_threads"_a = 0, "return_index"_a = false);
+
+    m.def(
+        "selfjoin_file",
+        &selfjoin_file_impl,
+        "input"_a, "output"_a, "m"_a, "output_index"_a = nb::none(), "normalize"_a = true,
+        "num_threads"_a = 1, "memory_budget"_a = size_t(1) << 30,
+        R"doc(
+        Compute the matrix profile of a time series stored in a file, out of core.
+
+        The input is memory-mapped and the distance matrix is processed in pairs of blocks of
+        subsequences, so that the resident memory stays within memory_budget bytes regardless of
+        the length of the time series. The next block is read ahead while the current one is
+        joined. Results are written to memory-mapped files and can be opened with
+        ``np.load(output, mmap_mode="r")``. Only supported by CPU backend.
+
+        Args:
+          input: Path of a 1-D float64 .npy file, or of a file of raw float64 values
+          output: Path of the matrix profile file. Written in .npy format if the path ends in
+            .npy, as raw float64 values otherwise.
+          m: Window size
+          output_index: Path of the matrix profile index file (int64), or None (default)
+          normalize: If True (default), use Z-normalized Euclidean distance. If False, use raw Euclidean distance.
+          num_threads: Number of threads to split each pair of blocks across (default: 1).
+            0 uses all available cores.
+          memory_budget: Approximate limit of the resident memory in bytes (default: 1 GiB).
+            Blocks hold at least max(4 * m, 2048) subsequences.
+    )doc");
+
+    m.def(
+        "abjoin_file",
+        &abjoin_file_impl,
+        "input1"_a, "input2"_a, "output"_a, "m"_a, "output_index"_a = nb::none(),
+        "normalize"_a = true, "num_threads"_a = 1, "memory_budget"_a = size_t(1) << 30,
+        R"doc(
+        Compute the matrix profile between time series stored in two files, out of core.
+
+        For each subsequence of the time series in input1, finds its nearest neighbor in the
+        time series in input2. See selfjoin_file for the file formats and the other arguments.
+        Only supported by CPU backend.
+
+        Args:
+          input1: Path of the first time series
+          input2: Path of the second time series
+          output: Path of the matrix profile file
+          m: Window size
+          output_index: Path of the matrix profile index file (int64), or None (default)
+          normalize: If True (default), use Z-normalized Euclidean distance. If False, use raw Euclidean distance.
+          num_threads: Number of threads to split each pair of blocks across (default: 1).
+            0 uses all available cores.
+          memory_budget: Approximate limit of the resident memory in bytes (default: 1 GiB)
+    )doc");
+
+    m.def(
+        "selfjoin_tile",
+        &selfjoin_tile_impl,
+        "T"_a, "m"_a, "rows"_a, "cols"_a, "normalize"_a = true, "num_threads"_a = 1,
+        "return_cols"_a = false,
+        R"doc(
+        Compute a partial matrix profile over a tile of the distance matrix of time series T.
+
+        The tile spans subsequences [rows[0], rows[1]) against subsequences [cols[0], cols[1]).
+        It computes its own dot products, so tiles of one self-join can be processed in any
+        order, by separate processes or nodes, and combined with merge_profiles. Since the
+        distance matrix is symmetric, only tiles on or above its main diagonal are needed when
+        the column profiles are merged as well. Only supported by CPU backend.
+
+        Args:
+          T: Time series
+          m: Window size
+          rows: (begin, end) range of the subsequences of the rows
+          cols: (begin, end) range of the subsequences of the columns
+          normalize: If True (default), use Z-normalized Euclidean distance. If False, use raw Euclidean distance.
+          num_threads: Number of threads to split the tile across (default: 1). 0 uses all
+            available cores.
+          return_cols: If True, also return the profile of the columns (default: False)
+
+        Returns:
+          Tuple (P_row, I_row) with the nearest neighbor of each row among the columns, with
+          indices into T, followed by (P_col, I_col) for the columns if return_cols is True.
+          Subsequences without a neighbor outside the exclusion zone get distance inf and
+          index -1.
+    )doc");
+
+    m.def(
+        "merge_profiles",
+        &merge_profiles_impl,
+        "P"_a, "I"_a, "P_other"_a, "I_other"_a,
+        R"doc(
+        Merge a partial matrix profile into another one in place.
+
+        Keeps the smaller distance of each subsequence and its index; of equal distances, the
+        smaller index is kept, so the result does not depend on the order of merges. Slices
+        such as P[begin:end] can be passed to merge the profile of a tile into the full profile.
+        Only supported by CPU backend.
+
+        Args:
+          P: Matrix profile (float64), updated in place
+          I: Matrix profile index (int64), updated in place
+          P_other: Matrix profile to merge
+          I_other: Matrix profile index to merge
+    )doc");
+
+    m.def(
+        "topk_motifs",
+        &topk_motifs_impl<double>,
+        "T"_a, "m"_a, "k"_a, "stream"_a = 0, "normalize"_a = true, "num_threads"_a = 1,
+        R"doc(
+        Find the top-k motifs of time series T.
+
+        Motifs are the subsequences with the smallest matrix profile values. Subsequences
+        within the exclusion zone (ceil(m/4)) of an earlier motif or of its nearest neighbor are
+        skipped. The matrix profile is not returned to Python. Only supported by CPU backend.
+
+        Args:
+          T: Time series
+          m: Window size
+          k: Maximum number of motifs
+          stream: Stream number (default: 0). Runs after the operations submitted to it before.
+          normalize: If True (default), use Z-normalized Euclidean distance. If False, use raw Euclidean distance.
+          num_threads: Number of threads to split the computation across (default: 1).
+            0 uses all available cores.
+
+        Returns:
+          List of (index, neighbor, distance) tuples ordered by increasing distance
+    )doc");
+    m.def("topk_motifs", &topk_motifs_impl<float>, "T"_a, "m"_a, "k"_a, "stream"_a = 0,
+          "normalize"_a = true, "num_threads"_a = 1);
+    m.def("topk_motifs", &topk_motifs_any, "T"_a, "m"_a, "k"_a, "stream"_a = 0,
+          "normalize"_a = true, "num_threads"_a = 1);
+
+    m.def(
+        "topk_discords",
+        &topk_discords_impl<double>,
+        "T"_a, "m"_a, "k"_a, "stream"_a = 0, "normalize"_a = true, "num_threads"_a = 1,
+        R"doc(
+        Find the top-k discords of time series T.
+
+        Discords are the subsequences with the largest matrix profile values. Subsequences
+        within the exclusion zone (ceil(m/4)) of an earlier discord are skipped. The matrix
+        profile is not returned to Python. Only supported by CPU backend.
+
+        Args:
+          T: Time series
+          m: Window size
+          k: Maximum number of discords
+          stream: Stream number (default: 0). Runs after the operations submitted to it before.
+          normalize: If True (default), use Z-normalized Euclidean distance. If False, use raw Euclidean distance.
+          num_threads: Number of threads to split the computation across (default: 1).
+            0 uses all available cores.
 
         Returns:
-          Matrix profile
+          List of (index, neighbor, distance) tuples ordered by decreasing distance
+    )doc");
+    m.def("topk_discords", &topk_discords_impl<float>, "T"_a, "m"_a, "k"_a, "stream"_a = 0,
+          "normalize"_a = true, "num_threads"_a = 1);
+    m.def("topk_discords", &topk_discords_any, "T"_a, "m"_a, "k"_a, "stream"_a = 0,
+          "normalize"_a = true, "num_threads"_a = 1);
+
+    nb::class_<PyPlan>(m, "Plan", R"doc(
+        Reusable self-join of time series of a fixed length.
+
+        Scratch buffers and FFT plans are allocated once when the plan is created, so that
+        computing many matrix profiles of the same length does no per-call setup. Calls to
+        execute() on one plan from several threads are serialized. Only supported by CPU
+        backend.
+    )doc")
+        .def(
+            "__init__",
+            [](PyPlan *self, size_t n, size_t m, bool normalize, int num_threads) {
+                if (!g_initialized) {
+                    throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+                }
+                new (self) PyPlan(n, m, normalize, num_threads);
+            },
+            "n"_a, "m"_a, "normalize"_a = true, "num_threads"_a = 1,
+            R"doc(
+            Args:
+              n: Length of the time series
+              m: Window size
+              normalize: If True (default), use Z-normalized Euclidean distance. If False, use raw Euclidean distance.
+              num_threads: Number of threads to split each computation across (default: 1).
+                0 uses all available cores.
+        )doc")
+        .def(
+            "execute",
+            [](PyPlan &self, const_pyarr_t<double> T, bool return_index, nb::handle out,
+               nb::handle out_index) -> nb::object {
+                if (!g_initialized) {
+                    throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+                }
+                if (T.shape(0) != self.size()) {
+                    throw std::runtime_error("T must be " + std::to_string(self.size()) +
+                                             " long.");
+                }
+
+                auto [P, P_data] = output_array<double>(out, self.profile_size());
+                nb::object I;
+                int64_t *I_data = nullptr;
+                if (return_index) {
+                    std::tie(I, I_data) = output_array<int64_t>(out_index, self.profile_size());
+                }
+
+                {
+                    nb::gil_scoped_release release;
+                    std::lock_guard<std::mutex> lock(self.mutex);
+                    self.execute(T.data(), P_data, I_data);
+                }
+
+                if (return_index) {
+                    return nb::make_tuple(P, I);
+                }
+                return P;
+            },
+            "T"_a, "return_index"_a = false, "out"_a = nb::none(), "out_index"_a = nb::none(),
+            R"doc(
+            Compute the matrix profile of time series T.
+
+            Args:
+              T: Time series (float64) of the length the plan was created for
+              return_index: If True, also return the matrix profile index (default: False)
+              out: float64 array to write the matrix profile to (default: None)
+              out_index: int64 array to write the matrix profile index to (default: None)
+
+            Returns:
+              Matrix profile, or tuple of matrix profile and matrix profile index (int64) if
+              return_index is True
+        )doc")
+        .def_prop_ro(
+            "n", [](const PyPlan &self) { return self.size(); }, "Length of the time series")
+        .def_prop_ro(
+            "m", [](const PyPlan &self) { return self.window_size(); }, "Window size");
+
+    nb::class_<PyStreamingSelfJoin>(m, "StreamingSelfJoin", R"doc(
+        Incrementally maintained matrix profile of a growing time series.
+
+        The matrix profile of the initial time series is computed once; afterwards, each
+        appended point updates the matrix profile and its index in O(n) time. Calls on one
+        object from several threads are serialized. Only supported by CPU backend.
+    )doc")
+        .def(
+            "__init__",
+            [](PyStreamingSelfJoin *self, const_pyarr_t<double> T, size_t m, bool normalize,
+               size_t capacity) {
+                if (!g_initialized) {
+                    throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+                }
+                nb::gil_scoped_release release;
+                new (self) PyStreamingSelfJoin(T.data(), T.shape(0), m, normalize, capacity);
+            },
+            "T"_a, "m"_a, "normalize"_a = true, "capacity"_a = 0,
+            R"doc(
+            Args:
+              T: Initial time series (may be shorter than m)
+              m: Window size
+              normalize: If True (default), use Z-normalized Euclidean distance. If False, use raw Euclidean distance.
+              capacity: Total number of points to reserve memory for (default: 0, grow as
+                needed)
+        )doc")
+        .def(
+            "append",
+            [](PyStreamingSelfJoin &self, const_pyarr_t<double> values) {
+                self.append(values.data(), values.shape(0));
+            },
+            "values"_a,
+            R"doc(
+            Append points to the time series and update the matrix profile.
+
+            Args:
+              values: A single value or an array of values
+        )doc")
+        .def(
+            "append",
+            [](PyStreamingSelfJoin &self, double value) { self.append(&value, 1); },
+            "value"_a)
+        .def_prop_ro(
+            "T",
+            [](PyStreamingSelfJoin &self) {
+                return self.locked_copy([&] {
+                    return pyarr_t<double>(const_cast<double *>(self.data()), {self.size()})
+                        .cast();
+                });
+            },
+            "Copy of the time series")
+        .def_prop_ro(
+            "P",
+            [](PyStreamingSelfJoin &self) {
+                return self.locked_copy([&] {
+                    return pyarr_t<double>(const_cast<double *>(self.profile()),
+                                           {self.profile_size()})
+                        .cast();
+                });
+            },
+            "Copy of the matrix profile")
+        .def_prop_ro(
+            "I",
+            [](PyStreamingSelfJoin &self) {
+                return self.locked_copy([&] {
+                    return index_pyarr_t(const_cast<int64_t *>(self.index()),
+                                         {self.profile_size()})
+                        .cast();
+                });
+            },
+            "Copy of the matrix profile index (int64)")
+        .def_prop_ro(
+            "m", [](const PyStreamingSelfJoin &self) { return self.window_size(); },
+            "Window size");
+
+    nb::class_<PyAnytimeSelfJoin>(m, "AnytimeSelfJoin", R"doc(
+        Anytime approximate self-join (SCRIMP++).
+
+        The distance matrix is processed in a random order of diagonals, so the best-so-far
+        matrix profile converges quickly towards the exact one. The computation is resumed by
+        every call to run() and is exact once done is True. Calls on one object from several
+        threads are serialized. Only supported by CPU backend.
+    )doc")
+        .def(
+            "__init__",
+            [](PyAnytimeSelfJoin *self, const_pyarr_t<double> T, size_t m, bool normalize,
+               int num_threads, uint64_t seed, bool prescrimp) {
+                if (!g_initialized) {
+                    throw std::runtime_error("quickmp not initialized. Call initialize() first.");
+                }
+                nb::gil_scoped_release release;
+                new (self) PyAnytimeSelfJoin(T.data(), T.shape(0), m, normalize, num_threads,
+                                             seed, prescrimp);
+            },
+            "T"_a, "m"_a, "normalize"_a = true, "num_threads"_a = 1, "seed"_a = 0,
+            "prescrimp"_a = true,
+            R"doc(
+            Args:
+              T: Time series
+              m: Window size
+              normalize: If True (default), use Z-normalized Euclidean distance. If False, use raw Euclidean distance.
+              num_threads: Number of threads to split the computation across (default: 1).
+                0 uses all available cores.
+              seed: Seed of the random order of diagonals (default: 0)
+              prescrimp: If True (default), start with PreSCRIMP, which quickly approximates
+                the matrix profile from a sample of rows.
+        )doc")
+        .def(
+            "run",
+            [](PyAnytimeSelfJoin &self, std::optional<double> time_budget,
+               std::optional<double> fraction) {
+                nb::gil_scoped_release release;
+                std::lock_guard<std::mutex> lock(self.mutex);
+                self.run(time_budget.value_or(INFINITY), fraction.value_or(1.0));
+
+                nb::gil_scoped_acquire acquire;
+                return pyarr_t<double>(const_cast<double *>(self.profile()),
+                                       {self.profile_size()})
+                    .cast();
+            },
+            "time_budget"_a = nb::none(), "fraction"_a = nb::none(),
+            R"doc(
+            Continue the computation and return the best-so-far matrix profile.
+
+            Stops after time_budget seconds or after a further fraction of all diagonals has
+            been processed, whichever comes first. Without either, the computation runs to the
+            exact matrix profile. Work is done in batches, so the time budget may be exceeded by
+            the duration of one batch.
+
+            Args:
+              time_budget: Wall-clock budget in seconds (default: None, unlimited)
+              fraction: Fraction of all diagonals to process (default: None, all remaining)
+
+            Returns:
+              Matrix profile (inf for subsequences not yet joined)
+        )doc")
+        .def_prop_ro(
+            "P",
+            [](PyAnytimeSelfJoin &self) {
+                return self.locked_copy([&] {
+                    return pyarr_t<double>(const_cast<double *>(self.profile()),
+                                           {self.profile_size()})
+                        .cast();
+                });
+            },
+            "Copy of the best-so-far matrix profile")
+        .def_prop_ro(
+            "I",
+            [](PyAnytimeSelfJoin &self) {
+                return self.locked_copy([&] {
+                    return index_pyarr_t(const_cast<int64_t *>(self.index()),
+                                         {self.profile_size()})
+                        .cast();
+                });
+            },
+            "Copy of the best-so-far matrix profile index (int64)")
+        .def_prop_ro(
+            "progress",
+            [](PyAnytimeSelfJoin &self) { return self.locked([&] { return self.progress(); }); },
+            "Fraction of diagonals processed so far")
+        .def_prop_ro(
+            "done", [](PyAnytimeSelfJoin &self) { return self.locked([&] { return self.done(); }); },
+            "True once the matrix profile is exact");
+
+    m.def(
+        "trim_memory_pool",
+        []() { quickmp::trim_memory_pool(); },
+        R"doc(
+        Free the host memory cached by quickmp's memory pool.
+
+        Temporary buffers and returned arrays are recycled through per-thread caches, so that
+        repeated computations do not allocate or page-fault. Caches of other threads are freed
+        the next time those threads use the pool. Also done by finalize().
     )doc");
 
     m.def(
@@ -249,13 +1752,40 @@ NB_MODULE(_quickmp, m) {
         Get the number of available streams for parallel execution.
 
         Returns:
-          int: Number of available streams (CPU cores for CPU backend,
-               VE streams for VE backend)
+          int: Number of available streams (usable CPUs of the current device for CPU
+               backend, see get_cpu_topology; VE streams for VE backend)
+    )doc");
+
+    m.def(
+        "get_cpu_topology",
+        []() {
+            quickmp::CpuTopology topology = quickmp::get_cpu_topology();
+            nb::dict result;
+            result["hardware_threads"] = topology.hardware_threads;
+            result["affinity_cpus"] = topology.affinity_cpus;
+            result["cpu_quota"] = topology.cpu_quota;
+            result["usable_cpus"] = topology.usable_cpus;
+            return result;
+        },
+        R"doc(
+        Get the CPUs available to the process.
+
+        The CPU backend sizes its default number of threads and streams after usable_cpus, so
+        that it does not oversubscribe containers whose affinity mask or cgroup CPU quota is
+        smaller than the host. Does not require initialize().
+
+        Returns:
+          dict with hardware_threads (hardware threads of the host), affinity_cpus (CPUs in the
+          affinity mask of the process), cpu_quota (CPUs granted by the cgroup v1 or v2 CPU
+          quota, 0.0 if unlimited) and usable_cpus (minimum of the above, quota rounded up)
     )doc");
 
     // Register cleanup function to be called at module unload
     static int dummy = 0;
     m.attr("_cleanup") = nb::capsule(&dummy, [](void *) noexcept {
+        // Workers may need the GIL to run the done callbacks of pending operations
+        nb::gil_scoped_release release;
+        std::lock_guard<std::mutex> lock(g_init_mutex);
         if (g_initialized) {
             quickmp::finalize();
             g_initialized = false;
@@ -0,0 +1,201 @@
+#include "cpu/affinity.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace {
+
+std::mutex g_affinity_mutex;
+// CPUs in the order workers are pinned to them (empty: workers are not pinned)
+std::vector<int> g_order;
+std::atomic<size_t> g_listed_cpus(0);
+std::atomic<uint64_t> g_affinity_epoch(0);
+// Slot given to pin_worker() by the calling thread and slot it is currently pinned to
+constexpr size_t NO_SLOT = static_cast<size_t>(-1);
+thread_local size_t t_home_slot = NO_SLOT;
+thread_local size_t t_current_slot = NO_SLOT;
+
+#ifdef __linux__
+// CPUs the process was allowed to run on when it first configured the policy
+const cpu_set_t &process_cpus() {
+    static const cpu_set_t set = [] {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        return set;
+    }();
+
+    return set;
+}
+
+int read_topology(int cpu, const char *name) {
+    std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/" + name);
+    int value = 0;
+    file >> value;
+    return value;
+}
+#endif
+
+struct Cpu {
+    int id;
+    int package;
+    int core;
+};
+
+std::vector<Cpu> available_cpus() {
+    std::vector<Cpu> cpus;
+#ifdef __linux__
+    for (int id = 0; id < CPU_SETSIZE; id++) {
+        if (CPU_ISSET(id, &process_cpus())) {
+            cpus.push_back({id, read_topology(id, "physical_package_id"),
+                            read_topology(id, "core_id")});
+        }
+    }
+#endif
+    return cpus;
+}
+
+// Fill the cores of one package before moving on to the next, with the hardware threads of a
+// core next to each other
+void sort_compact(std::vector<Cpu> &cpus) {
+    std::sort(cpus.begin(), cpus.end(), [](const Cpu &a, const Cpu &b) {
+        return std::tie(a.package, a.core, a.id) < std::tie(b.package, b.core, b.id);
+    });
+}
+
+std::vector<int> compact_order(std::vector<Cpu> cpus) {
+    sort_compact(cpus);
+
+    std::vector<int> order;
+    for (const Cpu &cpu : cpus) {
+        order.push_back(cpu.id);
+    }
+    return order;
+}
+
+// Alternate between packages, and use one hardware thread of every core before the second ones
+std::vector<int> scatter_order(std::vector<Cpu> cpus) {
+    sort_compact(cpus);
+
+    // Per package: (rank among the hardware threads of the core, core, CPU)
+    std::map<std::pair<int, int>, int> threads_of_core;
+    std::map<int, std::vector<std::tuple<int, int, int>>> packages;
+    for (const Cpu &cpu : cpus) {
+        int thread = threads_of_core[{cpu.package, cpu.core}]++;
+        packages[cpu.package].emplace_back(thread, cpu.core, cpu.id);
+    }
+
+    std::vector<std::vector<std::tuple<int, int, int>>> lists;
+    for (auto &entry : packages) {
+        std::sort(entry.second.begin(), entry.second.end());
+        lists.push_back(std::move(entry.second));
+    }
+
+    std::vector<int> order;
+    for (size_t i = 0; order.size() < cpus.size(); i++) {
+        for (const auto &list : lists) {
+            if (i < list.size()) {
+                order.push_back(std::get<2>(list[i]));
+            }
+        }
+    }
+    return order;
+}
+
+// Pin the calling thread to the CPU of slot, or let it run on any CPU of the process if there is
+// no policy. Returns whether the thread is pinned.
+bool pin_to_slot(size_t slot) {
+    bool pinned;
+#ifdef __linux__
+    cpu_set_t set;
+    {
+        std::lock_guard<std::mutex> lock(g_affinity_mutex);
+        pinned = !g_order.empty();
+        if (!pinned) {
+            // Undo an earlier policy
+            set = process_cpus();
+        } else {
+            CPU_ZERO(&set);
+            CPU_SET(g_order[slot % g_order.size()], &set);
+        }
+    }
+    // Pinning is best effort; a failure leaves the thread where it is
+    sched_setaffinity(0, sizeof(set), &set);
+#else
+    pinned = false;
+#endif
+    t_current_slot = pinned ? slot : NO_SLOT;
+    return pinned;
+}
+
+} // anonymous namespace
+
+void configure_affinity(const std::string &policy, const std::vector<int> &cpus) {
+    std::vector<int> order;
+
+    if (!cpus.empty()) {
+        for (int cpu : cpus) {
+#ifdef __linux__
+            if (cpu < 0 || cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &process_cpus())) {
+                throw std::runtime_error("CPU " + std::to_string(cpu) +
+                                         " is not available to the process.");
+            }
+#endif
+        }
+        order = cpus;
+    } else if (policy == "compact") {
+        order = compact_order(available_cpus());
+    } else if (policy == "scatter") {
+        order = scatter_order(available_cpus());
+    } else if (!policy.empty() && policy != "none") {
+        throw std::runtime_error("Unknown affinity policy: " + policy +
+                                 " (expected none, compact or scatter).");
+    }
+
+    std::lock_guard<std::mutex> lock(g_affinity_mutex);
+    g_order = std::move(order);
+    g_listed_cpus = cpus.size();
+    g_affinity_epoch++;
+}
+
+size_t listed_cpu_count() {
+    return g_listed_cpus;
+}
+
+void pin_worker(size_t slot, uint64_t &epoch) {
+    uint64_t current = g_affinity_epoch.load(std::memory_order_relaxed);
+    if (current == epoch) {
+        return;
+    }
+    epoch = current;
+
+    t_home_slot = slot;
+    pin_to_slot(slot);
+}
+
+SlotGuard::SlotGuard(size_t slot) {
+    if (t_home_slot == NO_SLOT || t_current_slot == slot) {
+        return;
+    }
+    moved_ = pin_to_slot(slot);
+}
+
+SlotGuard::~SlotGuard() {
+    if (moved_) {
+        pin_to_slot(t_home_slot);
+    }
+}
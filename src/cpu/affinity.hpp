@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Placement of the worker threads of the CPU backend (see InitOptions::affinity). The policy
+// orders the CPUs the process may run on; worker threads are numbered by slot, and the worker in
+// slot i is pinned to the i-th CPU of that order (wrapping around).
+
+// Set the policy: "" or "none", "compact" or "scatter", or an explicit list of CPUs if cpus is
+// not empty. Throws if the policy is unknown or a CPU is not available to the process. Workers
+// pick the new policy up before their next job.
+void configure_affinity(const std::string &policy, const std::vector<int> &cpus);
+
+// Number of CPUs in the explicit list of the policy, or 0 if there is none. The devices are sized
+// after it (see cpu/device.hpp).
+size_t listed_cpu_count();
+
+// Pin the calling worker thread to the CPU of slot if the policy changed since epoch, which is
+// updated. epoch must start at 0.
+void pin_worker(size_t slot, uint64_t &epoch);
+
+// Move the calling worker to the CPU of slot while the guard lives, then back to the slot it was
+// pinned to by pin_worker(). Does nothing for threads that are not pinned or already in slot.
+class SlotGuard {
+public:
+    explicit SlotGuard(size_t slot);
+    ~SlotGuard();
+
+    SlotGuard(const SlotGuard &) = delete;
+    SlotGuard &operator=(const SlotGuard &) = delete;
+
+private:
+    bool moved_ = false;
+};
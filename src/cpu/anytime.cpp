@@ -0,0 +1,247 @@
+#include "quickmp.hpp"
+#include "cpu/device.hpp"
+#include "cpu/internal.hpp"
+#include "cpu/join.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// Number of adjacent diagonals processed together. The diagonals are visited in a random order
+// of such groups rather than one by one so that the per-row overhead of the tile kernels stays
+// amortized; narrower groups make the whole join up to 2.5x slower.
+constexpr size_t GROUP_WIDTH = 256;
+
+// Distance between the rows sampled by PreSCRIMP. The original algorithm samples every
+// ceil(m/4)-th row, but evaluating a row with the sliding dot product costs about as much as
+// min(m, 64) rows of the diagonal kernels here. Sampling more sparsely keeps PreSCRIMP at a small
+// fraction of the exact join; each sample still extends along up to step - 1 elements of its
+// diagonal in both directions, so every row is covered.
+size_t prescrimp_step(size_t m, size_t excl_zone)
+{
+    return std::max<size_t>(excl_zone, 16 * std::min<size_t>(m, 64));
+}
+
+} // anonymous namespace
+
+namespace quickmp {
+
+struct AnytimeSelfJoin::Impl {
+    size_t m;
+    size_t l;
+    bool normalize;
+    size_t excl_zone;
+    size_t num_threads;
+
+    std::vector<double> T;
+    // QT_first[j]: dot product between the first subsequence and subsequence j
+    std::vector<double> QT_first;
+    // Statistics of every subsequence (mu and sigma_inv if normalized, S otherwise)
+    std::vector<double> mu, sigma_inv, S;
+    std::vector<double> P_score, P;
+    std::vector<int64_t> I;
+
+    // Rows evaluated by PreSCRIMP and groups of diagonals, in the order they are processed
+    std::vector<size_t> samples;
+    std::vector<std::pair<size_t, size_t>> groups;
+    size_t next_sample = 0;
+    size_t next_group = 0;
+    size_t diagonals_done = 0;
+    size_t total_diagonals = 0;
+
+    template <class F>
+    void with_score(F f)
+    {
+        if (normalize) {
+            f(ZNormalizedScore<double>{mu.data(), sigma_inv.data(), mu.data(), sigma_inv.data(),
+                                       m});
+        } else {
+            f(EuclideanScore<double>{S.data(), S.data()});
+        }
+    }
+
+    void relax(size_t i, size_t j, double score)
+    {
+        if (score > P_score[i]) {
+            P_score[i] = score;
+            I[i] = j;
+        }
+        if (score > P_score[j]) {
+            P_score[j] = score;
+            I[j] = i;
+        }
+    }
+
+    // Evaluate row i of the distance matrix and extend the nearest neighbor of subsequence i
+    // along its diagonal by up to step - 1 elements in both directions
+    template <class Score>
+    void prescrimp_row(const Score &score, size_t i, size_t step, host_vector<double> &qt)
+    {
+        ::sliding_dot_product(T.data(), T.data() + i, qt.data(), T.size(), m);
+
+        for (size_t j = 0; j < l; j++) {
+            if (j + excl_zone < i || i + excl_zone < j) {
+                relax(i, j, score(qt[j], i, j));
+            }
+        }
+
+        if (I[i] < 0) {
+            return;
+        }
+
+        size_t j = I[i];
+        double q = qt[j];
+
+        for (size_t x = 1; x < step && i + x < l && j + x < l; x++) {
+            q = q - T[i + x - 1] * T[j + x - 1] + T[i + x + m - 1] * T[j + x + m - 1];
+            relax(i + x, j + x, score(q, i + x, j + x));
+        }
+
+        q = qt[j];
+
+        for (size_t x = 1; x < step && x <= i && x <= j; x++) {
+            q = q - T[i - x + m] * T[j - x + m] + T[i - x] * T[j - x];
+            relax(i - x, j - x, score(q, i - x, j - x));
+        }
+    }
+
+    template <class Score>
+    void run(const Score &score, double time_budget, double fraction)
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto expired = [&]() {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            return elapsed.count() >= time_budget;
+        };
+
+        if (next_sample < samples.size()) {
+            size_t step = prescrimp_step(m, excl_zone);
+            host_vector<double> qt(l);
+
+            while (next_sample < samples.size() && !expired()) {
+                prescrimp_row(score, samples[next_sample++], step, qt);
+            }
+        }
+
+        size_t target = diagonals_done + std::ceil(std::clamp(fraction, 0.0, 1.0) *
+                                                   total_diagonals);
+
+        // Each batch gives every thread a few groups to balance, and the budget is checked
+        // between batches
+        size_t batch_size = num_threads <= 1 ? 1 : num_threads * 4;
+
+        while (next_group < groups.size() && diagonals_done < target && !expired()) {
+            std::vector<std::pair<size_t, size_t>> batch;
+
+            while (next_group < groups.size() && diagonals_done < target &&
+                   batch.size() < batch_size) {
+                const auto &group = groups[next_group++];
+                batch.push_back(group);
+                diagonals_done += group.second - group.first;
+            }
+
+            join_tiles<true, true>(score, T.data(), T.data(), QT_first.data(), P_score.data(),
+                                   I.data(), P_score.data(), I.data(), l, l, m, batch,
+                                   num_threads);
+        }
+
+        // Subsequences not joined yet are found by their index rather than their -inf score
+        for (size_t i = 0; i < l; i++) {
+            P[i] = I[i] >= 0 ? score.distance(P_score[i]) : INFINITY;
+        }
+    }
+};
+
+AnytimeSelfJoin::AnytimeSelfJoin(const double *T, size_t n, size_t m, bool normalize,
+                                 int num_threads, uint64_t seed, bool prescrimp)
+    : impl_(new Impl()) {
+    if (m == 0 || n < m) {
+        throw std::runtime_error("Time series must be at least as long as the window size.");
+    }
+
+    Impl &impl = *impl_;
+    size_t l = n - m + 1;
+
+    impl.m = m;
+    impl.l = l;
+    impl.normalize = normalize;
+    impl.excl_zone = std::ceil(m / 4.0);
+    impl.num_threads = resolve_num_threads(num_threads);
+    impl.T.assign(T, T + n);
+
+    if (normalize) {
+        impl.mu.resize(l);
+        impl.sigma_inv.resize(l);
+        ::compute_mean_std(T, impl.mu.data(), impl.sigma_inv.data(), n, m);
+        for (size_t i = 0; i < l; i++) {
+            impl.sigma_inv[i] = 1.0 / impl.sigma_inv[i];
+        }
+    } else {
+        impl.S.resize(l);
+        ::compute_squared_sum(T, impl.S.data(), n, m);
+    }
+
+    impl.QT_first.resize(l);
+    ::sliding_dot_product(T, T, impl.QT_first.data(), n, m);
+
+    impl.P_score.assign(l, -INFINITY);
+    impl.P.assign(l, INFINITY);
+    impl.I.assign(l, -1);
+
+    std::mt19937_64 rng(seed);
+
+    if (prescrimp) {
+        for (size_t i = 0; i < l; i += prescrimp_step(m, impl.excl_zone)) {
+            impl.samples.push_back(i);
+        }
+        std::shuffle(impl.samples.begin(), impl.samples.end(), rng);
+    }
+
+    for (size_t k = impl.excl_zone + 1; k < l; k += GROUP_WIDTH) {
+        impl.groups.emplace_back(k, std::min(k + GROUP_WIDTH, l));
+    }
+    std::shuffle(impl.groups.begin(), impl.groups.end(), rng);
+
+    impl.total_diagonals = l > impl.excl_zone + 1 ? l - impl.excl_zone - 1 : 0;
+}
+
+AnytimeSelfJoin::~AnytimeSelfJoin() = default;
+
+AnytimeSelfJoin::AnytimeSelfJoin(AnytimeSelfJoin &&) noexcept = default;
+
+AnytimeSelfJoin &AnytimeSelfJoin::operator=(AnytimeSelfJoin &&) noexcept = default;
+
+bool AnytimeSelfJoin::run(double time_budget, double fraction) {
+    impl_->with_score([&](const auto &score) { impl_->run(score, time_budget, fraction); });
+    return done();
+}
+
+double AnytimeSelfJoin::progress() const {
+    if (impl_->total_diagonals == 0) {
+        return 1.0;
+    }
+    return static_cast<double>(impl_->diagonals_done) / impl_->total_diagonals;
+}
+
+bool AnytimeSelfJoin::done() const {
+    return impl_->next_group == impl_->groups.size();
+}
+
+size_t AnytimeSelfJoin::profile_size() const {
+    return impl_->l;
+}
+
+const double *AnytimeSelfJoin::profile() const {
+    return impl_->P.data();
+}
+
+const int64_t *AnytimeSelfJoin::index() const {
+    return impl_->I.data();
+}
+
+} // namespace quickmp
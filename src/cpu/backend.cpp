@@ -1,87 +1,370 @@
 #include "quickmp.hpp"
+#include "cpu/affinity.hpp"
+#include "cpu/device.hpp"
 #include "cpu/internal.hpp"
+#include "cpu/simd.hpp"
+#include "cpu/stream.hpp"
+#include "cpu/thread_pool.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <mutex>
+#include <numeric>
 #include <stdexcept>
 #include <thread>
+#include <vector>
 #include <unistd.h>
 
 namespace {
 
+std::mutex g_init_mutex;
 bool g_initialized = false;
+std::string g_backend = "cpu";
+
+// Instruction set of backend, or throws if it is not one of list_backends()
+SimdIsa backend_simd_isa(const std::string &backend) {
+    if (backend == "cpu") {
+        return default_simd_isa();
+    }
+
+    for (SimdIsa isa : {SimdIsa::Generic, SimdIsa::AVX2, SimdIsa::AVX512}) {
+        if (backend == std::string("cpu-") + simd_isa_name(isa) && isa <= detect_simd_isa()) {
+            return isa;
+        }
+    }
+
+    std::string names;
+    for (const std::string &name : quickmp::list_backends()) {
+        names += (names.empty() ? "" : ", ") + name;
+    }
+    throw std::runtime_error("Unknown or unsupported backend: " + backend + " (available: " +
+                             names + ").");
+}
+
+template <typename Scalar>
+void selfjoin_impl(const Scalar *T, Scalar *P, int64_t *I, size_t n, size_t m, bool normalize,
+                   int num_threads, bool low_memory = false) {
+    size_t threads = resolve_num_threads(num_threads);
+
+    if (normalize) {
+        ::selfjoin<Scalar>(T, P, I, n, m, threads, nullptr, low_memory);
+    } else {
+        ::selfjoin_ed<Scalar>(T, P, I, n, m, threads, nullptr, low_memory);
+    }
+}
+
+template <typename Scalar>
+void abjoin_impl(const Scalar *T1, const Scalar *T2, Scalar *P, int64_t *I,
+                 size_t n1, size_t n2, size_t m, bool normalize) {
+    if (normalize) {
+        ::abjoin(T1, T2, P, I, n1, n2, m);
+    } else {
+        ::abjoin_ed(T1, T2, P, I, n1, n2, m);
+    }
+}
+
+// Run join(s, workspace) for every series s on num_threads threads. Series are handed out
+// longest job first by cost, so that a long series started last does not leave the other
+// threads idle.
+template <typename Scalar, class Join>
+void batch_impl(size_t num_series, int num_threads, const std::vector<size_t> &cost, Join join) {
+    size_t threads = resolve_num_threads(num_threads);
+
+    std::vector<size_t> order(num_series);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](size_t a, size_t b) { return cost[a] > cost[b]; });
+
+    size_t num_workers = std::min(threads, num_series);
+    std::vector<Workspace<Scalar>> workspaces(num_workers);
+    std::atomic<size_t> next(0);
+
+    device_thread_pool().parallel_for(num_workers, [&](size_t tid) {
+        for (size_t c = next++; c < num_series; c = next++) {
+            join(order[c], &workspaces[tid]);
+        }
+    });
+}
+
+template <typename Scalar>
+void selfjoin_batch_impl(const Scalar *const *T, Scalar *const *P, int64_t *const *I,
+                         const size_t *n, size_t num_series, size_t m, bool normalize,
+                         int num_threads) {
+    std::vector<size_t> cost(num_series);
+    for (size_t s = 0; s < num_series; s++) {
+        cost[s] = (n[s] - m + 1) * (n[s] - m + 1);
+    }
+
+    batch_impl<Scalar>(num_series, num_threads, cost, [&](size_t s, Workspace<Scalar> *ws) {
+        int64_t *Is = I ? I[s] : nullptr;
+        if (normalize) {
+            ::selfjoin(T[s], P[s], Is, n[s], m, 1, ws);
+        } else {
+            ::selfjoin_ed(T[s], P[s], Is, n[s], m, 1, ws);
+        }
+    });
+}
+
+template <typename Scalar>
+void abjoin_batch_impl(const Scalar *const *T1, const Scalar *const *T2, Scalar *const *P,
+                       int64_t *const *I, const size_t *n1, const size_t *n2, size_t num_series,
+                       size_t m, bool normalize, int num_threads) {
+    std::vector<size_t> cost(num_series);
+    for (size_t s = 0; s < num_series; s++) {
+        cost[s] = (n1[s] - m + 1) * (n2[s] - m + 1);
+    }
+
+    batch_impl<Scalar>(num_series, num_threads, cost, [&](size_t s, Workspace<Scalar> *ws) {
+        int64_t *Is = I ? I[s] : nullptr;
+        if (normalize) {
+            ::abjoin(T1[s], T2[s], P[s], Is, n1[s], n2[s], m, 1, ws);
+        } else {
+            ::abjoin_ed(T1[s], T2[s], P[s], Is, n1[s], n2[s], m, 1, ws);
+        }
+    });
+}
+
+template <typename Scalar>
+size_t topk_impl(const Scalar *T, size_t n, size_t m, size_t k, bool discords, int64_t *index,
+                 int64_t *neighbor, Scalar *distance, bool normalize, int num_threads) {
+    size_t l = n - m + 1;
+    quickmp::host_vector<Scalar> P(l);
+    quickmp::host_vector<int64_t> I(l);
+
+    selfjoin_impl(T, P.data(), I.data(), n, m, normalize, num_threads);
+
+    return select_topk(P.data(), I.data(), l, k, std::ceil(m / 4.0), discords, index, neighbor,
+                       distance);
+}
 
 } // anonymous namespace
 
 namespace quickmp {
 
-void initialize() {
+void initialize(const InitOptions &options) {
+    std::lock_guard<std::mutex> lock(g_init_mutex);
     if (g_initialized) {
         throw std::runtime_error("quickmp already initialized. Call finalize() first.");
     }
+    std::string backend = options.backend;
+    if (backend.empty()) {
+        const char *env = std::getenv("QUICKMP_BACKEND");
+        backend = env ? env : "cpu";
+    }
+    SimdIsa isa = backend_simd_isa(backend);
+
+    // The devices are sized after the explicit list of CPUs, if any
+    configure_affinity(options.affinity, options.cpus);
+    try {
+        configure_devices(options.cpu_devices);
+    } catch (...) {
+        configure_affinity("", {});
+        throw;
+    }
+    // Pinned workers keep their buffers on their own node
+    bool pinned = !options.cpus.empty() ||
+                  (!options.affinity.empty() && options.affinity != "none");
+    configure_host_pool(options.huge_pages, options.numa_local || pinned);
+    select_simd_isa(isa);
+    g_backend = backend;
     g_initialized = true;
 }
 
 void finalize() {
+    std::lock_guard<std::mutex> lock(g_init_mutex);
     if (!g_initialized) {
         throw std::runtime_error("quickmp not initialized.");
     }
     g_initialized = false;
-}
 
-int get_device_count() {
-    // CPU backend always has exactly 1 device
-    return 1;
+    shutdown_streams();
+    shutdown_devices();
+    configure_affinity("", {});
+    trim_memory_pool();
+    select_simd_isa(default_simd_isa());
 }
 
-void use_device(int device) {
-    if (device != 0) {
-        throw std::runtime_error("CPU backend only supports device 0.");
+std::vector<std::string> list_backends() {
+    std::vector<std::string> names = {"cpu"};
+    for (SimdIsa isa : {SimdIsa::Generic, SimdIsa::AVX2, SimdIsa::AVX512}) {
+        if (isa <= detect_simd_isa()) {
+            names.push_back(std::string("cpu-") + simd_isa_name(isa));
+        }
     }
-    // No-op for CPU backend
+    return names;
 }
 
-int get_current_device() {
-    // CPU backend always uses device 0
-    return 0;
+std::string get_backend() {
+    std::lock_guard<std::mutex> lock(g_init_mutex);
+    return g_backend;
 }
 
-int get_stream_count() {
-    unsigned int cores = std::thread::hardware_concurrency();
-    return cores > 0 ? static_cast<int>(cores) : 1;
+void sliding_dot_product(const double *T, const double *Q, double *QT,
+                         size_t n, size_t m, int stream) {
+    wait_for_stream(stream);
+    ::sliding_dot_product(T, Q, QT, n, m);
 }
 
-void sliding_dot_product(const double *T, const double *Q, double *QT,
+void sliding_dot_product(const float *T, const float *Q, float *QT,
                          size_t n, size_t m, int stream) {
-    (void)stream;
-    sliding_dot_product_fft(T, Q, QT, n, m);
+    wait_for_stream(stream);
+    ::sliding_dot_product(T, Q, QT, n, m);
 }
 
 void compute_mean_std(const double *T, double *mu, double *sigma,
                       size_t n, size_t m, int stream) {
-    (void)stream;
+    wait_for_stream(stream);
     ::compute_mean_std(T, mu, sigma, n, m);
 }
 
-void selfjoin(const double *T, double *P, size_t n, size_t m, int stream, bool normalize) {
-    (void)stream;
-    if (normalize) {
-        ::selfjoin(T, P, n, m);
-    } else {
-        ::selfjoin_ed(T, P, n, m);
-    }
+void compute_mean_std(const float *T, float *mu, float *sigma,
+                      size_t n, size_t m, int stream) {
+    wait_for_stream(stream);
+    ::compute_mean_std(T, mu, sigma, n, m);
+}
+
+void selfjoin(const double *T, double *P, size_t n, size_t m, int stream, bool normalize,
+              int num_threads, bool low_memory) {
+    wait_for_stream(stream);
+    selfjoin_impl(T, P, nullptr, n, m, normalize, num_threads, low_memory);
+}
+
+void selfjoin(const double *T, double *P, int64_t *I, size_t n, size_t m, int stream,
+              bool normalize, int num_threads, bool low_memory) {
+    wait_for_stream(stream);
+    selfjoin_impl(T, P, I, n, m, normalize, num_threads, low_memory);
+}
+
+void selfjoin(const float *T, float *P, size_t n, size_t m, int stream, bool normalize,
+              int num_threads, bool low_memory) {
+    wait_for_stream(stream);
+    selfjoin_impl(T, P, nullptr, n, m, normalize, num_threads, low_memory);
+}
+
+void selfjoin(const float *T, float *P, int64_t *I, size_t n, size_t m, int stream,
+              bool normalize, int num_threads, bool low_memory) {
+    wait_for_stream(stream);
+    selfjoin_impl(T, P, I, n, m, normalize, num_threads, low_memory);
 }
 
 void abjoin(const double *T1, const double *T2, double *P,
             size_t n1, size_t n2, size_t m, int stream, bool normalize) {
-    (void)stream;
-    if (normalize) {
-        ::abjoin(T1, T2, P, n1, n2, m);
-    } else {
-        ::abjoin_ed(T1, T2, P, n1, n2, m);
-    }
+    wait_for_stream(stream);
+    abjoin_impl(T1, T2, P, nullptr, n1, n2, m, normalize);
+}
+
+void abjoin(const double *T1, const double *T2, double *P, int64_t *I,
+            size_t n1, size_t n2, size_t m, int stream, bool normalize) {
+    wait_for_stream(stream);
+    abjoin_impl(T1, T2, P, I, n1, n2, m, normalize);
+}
+
+void abjoin(const float *T1, const float *T2, float *P,
+            size_t n1, size_t n2, size_t m, int stream, bool normalize) {
+    wait_for_stream(stream);
+    abjoin_impl(T1, T2, P, nullptr, n1, n2, m, normalize);
+}
+
+void abjoin(const float *T1, const float *T2, float *P, int64_t *I,
+            size_t n1, size_t n2, size_t m, int stream, bool normalize) {
+    wait_for_stream(stream);
+    abjoin_impl(T1, T2, P, I, n1, n2, m, normalize);
+}
+
+void sliding_dot_product_async(const double *T, const double *Q, double *QT, size_t n, size_t m,
+                               int stream) {
+    get_stream(stream)->submit([=] { ::sliding_dot_product(T, Q, QT, n, m); });
+}
+
+void sliding_dot_product_async(const float *T, const float *Q, float *QT, size_t n, size_t m,
+                               int stream) {
+    get_stream(stream)->submit([=] { ::sliding_dot_product(T, Q, QT, n, m); });
+}
+
+void compute_mean_std_async(const double *T, double *mu, double *sigma, size_t n, size_t m,
+                            int stream) {
+    get_stream(stream)->submit([=] { ::compute_mean_std(T, mu, sigma, n, m); });
+}
+
+void compute_mean_std_async(const float *T, float *mu, float *sigma, size_t n, size_t m,
+                            int stream) {
+    get_stream(stream)->submit([=] { ::compute_mean_std(T, mu, sigma, n, m); });
+}
+
+void selfjoin_async(const double *T, double *P, int64_t *I, size_t n, size_t m, int stream,
+                    bool normalize, int num_threads) {
+    get_stream(stream)->submit([=] { selfjoin_impl(T, P, I, n, m, normalize, num_threads); });
+}
+
+void selfjoin_async(const float *T, float *P, int64_t *I, size_t n, size_t m, int stream,
+                    bool normalize, int num_threads) {
+    get_stream(stream)->submit([=] { selfjoin_impl(T, P, I, n, m, normalize, num_threads); });
+}
+
+void abjoin_async(const double *T1, const double *T2, double *P, int64_t *I, size_t n1,
+                  size_t n2, size_t m, int stream, bool normalize) {
+    get_stream(stream)->submit([=] { abjoin_impl(T1, T2, P, I, n1, n2, m, normalize); });
+}
+
+void abjoin_async(const float *T1, const float *T2, float *P, int64_t *I, size_t n1, size_t n2,
+                  size_t m, int stream, bool normalize) {
+    get_stream(stream)->submit([=] { abjoin_impl(T1, T2, P, I, n1, n2, m, normalize); });
+}
+
+void selfjoin_batch(const double *const *T, double *const *P, int64_t *const *I, const size_t *n,
+                    size_t num_series, size_t m, bool normalize, int num_threads) {
+    selfjoin_batch_impl(T, P, I, n, num_series, m, normalize, num_threads);
+}
+
+void abjoin_batch(const double *const *T1, const double *const *T2, double *const *P,
+                  int64_t *const *I, const size_t *n1, const size_t *n2, size_t num_series,
+                  size_t m, bool normalize, int num_threads) {
+    abjoin_batch_impl(T1, T2, P, I, n1, n2, num_series, m, normalize, num_threads);
+}
+
+void selfjoin_batch(const float *const *T, float *const *P, int64_t *const *I, const size_t *n,
+                    size_t num_series, size_t m, bool normalize, int num_threads) {
+    selfjoin_batch_impl(T, P, I, n, num_series, m, normalize, num_threads);
+}
+
+void abjoin_batch(const float *const *T1, const float *const *T2, float *const *P,
+                  int64_t *const *I, const size_t *n1, const size_t *n2, size_t num_series,
+                  size_t m, bool normalize, int num_threads) {
+    abjoin_batch_impl(T1, T2, P, I, n1, n2, num_series, m, normalize, num_threads);
+}
+
+size_t topk_motifs(const double *T, size_t n, size_t m, size_t k, int64_t *index,
+                   int64_t *neighbor, double *distance, int stream, bool normalize,
+                   int num_threads) {
+    wait_for_stream(stream);
+    return topk_impl(T, n, m, k, false, index, neighbor, distance, normalize, num_threads);
+}
+
+size_t topk_discords(const double *T, size_t n, size_t m, size_t k, int64_t *index,
+                     int64_t *neighbor, double *distance, int stream, bool normalize,
+                     int num_threads) {
+    wait_for_stream(stream);
+    return topk_impl(T, n, m, k, true, index, neighbor, distance, normalize, num_threads);
+}
+
+size_t topk_motifs(const float *T, size_t n, size_t m, size_t k, int64_t *index,
+                   int64_t *neighbor, float *distance, int stream, bool normalize,
+                   int num_threads) {
+    wait_for_stream(stream);
+    return topk_impl(T, n, m, k, false, index, neighbor, distance, normalize, num_threads);
+}
+
+size_t topk_discords(const float *T, size_t n, size_t m, size_t k, int64_t *index,
+                     int64_t *neighbor, float *distance, int stream, bool normalize,
+                     int num_threads) {
+    wait_for_stream(stream);
+    return topk_impl(T, n, m, k, true, index, neighbor, distance, normalize, num_threads);
 }
 
 void sleep_us(uint64_t microseconds, int stream) {
-    (void)stream;
+    wait_for_stream(stream);
     usleep(microseconds);
 }
 
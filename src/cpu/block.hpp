@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "cpu/internal.hpp"
+#include "cpu/join.hpp"
+
+// Joins between blocks of consecutive subsequences of time series that are not held in memory
+// as a whole, used by the out-of-core joins (cpu/out_of_core.cpp) and the tile API
+// (cpu/tile.cpp). Only the statistics of the two blocks are computed, and the dot products of
+// every tile are seeded directly from the time series.
+
+// Consecutive subsequences [begin, begin + length) of a time series and their statistics
+struct Block {
+    const double *T;
+    size_t begin;
+    size_t length;
+    quickmp::host_vector<double> mu, sigma_inv, S;
+
+    void load(const double *series, size_t begin_, size_t length_, size_t m, bool normalize)
+    {
+        T = series + begin_;
+        begin = begin_;
+        length = length_;
+
+        if (normalize) {
+            mu.resize(length);
+            sigma_inv.resize(length);
+            compute_mean_std(T, mu.data(), sigma_inv.data(), length + m - 1, m);
+
+            for (size_t i = 0; i < length; i++) {
+                sigma_inv[i] = 1.0 / sigma_inv[i];
+            }
+        } else {
+            S.resize(length);
+            compute_squared_sum(T, S.data(), length + m - 1, m);
+        }
+    }
+};
+
+// Scores between the subsequences of two blocks
+template <class Score>
+Score block_score(const Block &a, const Block &b, size_t m);
+
+template <>
+inline ZNormalizedScore<double> block_score(const Block &a, const Block &b, size_t m)
+{
+    return {a.mu.data(), a.sigma_inv.data(), b.mu.data(), b.sigma_inv.data(), m};
+}
+
+template <>
+inline EuclideanScore<double> block_score(const Block &a, const Block &b, size_t)
+{
+    return {a.S.data(), b.S.data()};
+}
+
+// Profile (as scores) and index accumulated over a block, with indices local to the other block
+struct BlockProfile {
+    quickmp::host_vector<double> P;
+    quickmp::host_vector<int64_t> I;
+
+    void reset(size_t length, bool index)
+    {
+        P.assign(length, -INFINITY);
+        if (index) {
+            I.assign(length, -1);
+        }
+    }
+};
+
+// Join diagonals [k_first, k_end) of the distance matrix between blocks a (rows) and b (columns)
+template <bool RowProfile, bool ColProfile, class Score>
+void join_blocks(const Score &score, const Block &a, const Block &b, BlockProfile *pa,
+                 BlockProfile *pb, bool index, size_t m, size_t k_first, size_t k_end,
+                 size_t num_threads, Workspace<double> &ws)
+{
+    partition_diagonals(a.length, b.length, k_first, tile_count(num_threads), ws.tiles, k_end);
+
+    double *PA = RowProfile ? pa->P.data() : nullptr;
+    int64_t *IA = RowProfile && index ? pa->I.data() : nullptr;
+    double *PB = ColProfile ? pb->P.data() : nullptr;
+    int64_t *IB = ColProfile && index ? pb->I.data() : nullptr;
+
+    join_tiles<RowProfile, ColProfile>(score, a.T, b.T, static_cast<const double *>(nullptr), PA,
+                                       IA, PB, IB, a.length, b.length, m, ws.tiles, num_threads,
+                                       &ws, true);
+}
+
+// Merge the profile of a block into P and I (if not null), offsetting its indices by offset
+inline void merge_block(double *P, int64_t *I, const BlockProfile &profile, size_t length,
+                        size_t offset)
+{
+    for (size_t t = 0; t < length; t++) {
+        if (profile.P[t] > P[t]) {
+            P[t] = profile.P[t];
+            if (I) {
+                I[t] = profile.I[t] + offset;
+            }
+        }
+    }
+}
@@ -0,0 +1,134 @@
+#include "quickmp.hpp"
+#include "cpu/affinity.hpp"
+#include "cpu/device.hpp"
+#include "cpu/thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::mutex g_devices_mutex;
+std::atomic<int> g_num_devices(1);
+// Created on first use, one per device (unused with a single device)
+std::vector<std::unique_ptr<ThreadPool>> g_device_pools;
+thread_local int g_current_device = 0;
+
+size_t usable_cpus() {
+    return quickmp::get_cpu_topology().usable_cpus;
+}
+
+// Cores split between the devices: the usable CPUs, or the explicit list of CPUs the workers are
+// pinned to if it is shorter
+size_t host_core_count() {
+    size_t listed = listed_cpu_count();
+    return listed > 0 ? std::min(listed, usable_cpus()) : usable_cpus();
+}
+
+} // anonymous namespace
+
+void configure_devices(int num_devices) {
+    if (num_devices < 1) {
+        throw std::runtime_error("cpu_devices must be positive.");
+    }
+    if (static_cast<size_t>(num_devices) > host_core_count()) {
+        throw std::runtime_error("cpu_devices must not exceed the number of usable or listed "
+                                 "CPUs (" + std::to_string(host_core_count()) + ").");
+    }
+
+    std::lock_guard<std::mutex> lock(g_devices_mutex);
+    g_num_devices = num_devices;
+    g_device_pools.clear();
+    g_device_pools.resize(num_devices);
+    g_current_device = 0;
+}
+
+void shutdown_devices() {
+    std::vector<std::unique_ptr<ThreadPool>> pools;
+    {
+        std::lock_guard<std::mutex> lock(g_devices_mutex);
+        pools.swap(g_device_pools);
+        g_num_devices = 1;
+    }
+    g_current_device = 0;
+}
+
+int current_device() {
+    // A selection made before finalize() may refer to a device that no longer exists
+    return g_current_device < g_num_devices ? g_current_device : 0;
+}
+
+void set_current_device(int device) {
+    g_current_device = device;
+}
+
+size_t device_first_core(int device) {
+    size_t cores = host_core_count();
+    size_t devices = g_num_devices;
+    size_t d = device;
+
+    // The first cores % devices devices get one extra core
+    return d * (cores / devices) + std::min(d, cores % devices);
+}
+
+size_t device_core_count(int device) {
+    size_t cores = host_core_count();
+    size_t devices = g_num_devices;
+    size_t d = device;
+
+    return cores / devices + (d < cores % devices ? 1 : 0);
+}
+
+ThreadPool &device_thread_pool() {
+    int device = current_device();
+
+    std::lock_guard<std::mutex> lock(g_devices_mutex);
+    if (static_cast<size_t>(device) >= g_device_pools.size() ||
+        (g_num_devices == 1 && host_core_count() == usable_cpus())) {
+        return global_thread_pool();
+    }
+    if (!g_device_pools[device]) {
+        // The caller of parallel_for (a stream worker of the device) takes the first slot
+        g_device_pools[device] = std::make_unique<ThreadPool>(device_core_count(device) - 1,
+                                                              device_first_core(device) + 1);
+    }
+    return *g_device_pools[device];
+}
+
+size_t resolve_num_threads(int num_threads) {
+    if (num_threads < 0) {
+        throw std::runtime_error("num_threads must be non-negative.");
+    }
+    if (num_threads == 0) {
+        num_threads = quickmp::get_stream_count();
+    }
+    return std::min<size_t>(num_threads, device_thread_pool().size() + 1);
+}
+
+namespace quickmp {
+
+int get_device_count() {
+    return g_num_devices;
+}
+
+void use_device(int device) {
+    if (device < 0 || device >= get_device_count()) {
+        throw std::runtime_error("Invalid device ID: " + std::to_string(device));
+    }
+    g_current_device = device;
+}
+
+int get_current_device() {
+    return current_device();
+}
+
+int get_stream_count() {
+    return static_cast<int>(device_core_count(current_device()));
+}
+
+} // namespace quickmp
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+
+class ThreadPool;
+
+// Virtual devices of the CPU backend (see InitOptions::cpu_devices). The cores of the host are
+// split into contiguous groups, one per device, each with its own streams and thread pool. The
+// cores are the usable CPUs (see get_cpu_topology), or the explicit list of InitOptions::cpus if
+// it is shorter. A single device that covers all usable CPUs uses the process-wide thread pool.
+
+// Set the number of devices and select device 0 on the calling thread. Called by initialize()
+// after configure_affinity().
+void configure_devices(int num_devices);
+
+// Release the thread pools of the devices. Called by finalize() after the streams are shut down.
+void shutdown_devices();
+
+// Device selected on the calling thread. Stream workers run on the device of their stream.
+int current_device();
+void set_current_device(int device);
+
+// Cores [device_first_core(device), device_first_core(device) + device_core_count(device)) form
+// the core group of device
+size_t device_first_core(int device);
+size_t device_core_count(int device);
+
+// Thread pool of the device selected on the calling thread, with one worker per core of the
+// device besides the caller
+ThreadPool &device_thread_pool();
+
+// Threads to use for a kernel on the current device: num_threads, or one per core of the device
+// if 0, capped at the workers of device_thread_pool() plus the caller. Throws if num_threads is
+// negative.
+size_t resolve_num_threads(int num_threads);
@@ -1,34 +1,82 @@
+#include <algorithm>
+#include <cmath>
 #include <complex>
+#include <memory>
 #include <vector>
 
 #define POCKETFFT_NO_MULTITHREADING
 #include "pocketfft.hpp"
 
-void sliding_dot_product_fft(const double *T, const double *Q, double *QT, size_t n, size_t m)
+#include "cpu/internal.hpp"
+
+namespace {
+
+// Length of the circular convolution. Only QT[0], ..., QT[n - m] are needed, which are free of
+// wrap-around as long as it is at least n long.
+size_t fft_length(size_t n)
+{
+    return pocketfft::detail::util::good_size_real(n);
+}
+
+void prepare_fft(DotProductWorkspace &ws, size_t n)
 {
-    std::vector<double> Ta(n * 2), Qra(n * 2);
-    std::vector<std::complex<double>> Taf(n + 1), Qraf(n + 1);
+    size_t len = fft_length(n);
 
-    for (size_t i = 0; i < n; i++) {
-        Ta[i] = T[i];
+    if (!ws.plan || ws.plan->length() != len) {
+        ws.plan = std::make_shared<pocketfft::detail::pocketfft_r<double>>(len);
     }
+    ws.Ta.resize(len);
+    ws.Qra.resize(len);
+}
+
+bool use_fft(size_t n, size_t m)
+{
+    // Estimated cost in multiply-adds. The constant of the FFT covers the three real transforms
+    // and was calibrated so that the crossover matches measurements (around m = 200).
+    double naive_cost = static_cast<double>(n - m + 1) * m;
+    double fft_cost = 12.0 * n * std::log2(static_cast<double>(n) + 1.0);
+
+    return naive_cost > fft_cost;
+}
+
+} // anonymous namespace
+
+void sliding_dot_product_fft(const double *T, const double *Q, double *QT, size_t n, size_t m,
+                             DotProductWorkspace *workspace)
+{
+    DotProductWorkspace local;
+    DotProductWorkspace &ws = workspace ? *workspace : local;
+    prepare_fft(ws, n);
+
+    size_t len = ws.Ta.size();
+    double *Ta = ws.Ta.data();
+    double *Qra = ws.Qra.data();
+
+    std::copy(T, T + n, Ta);
+    std::fill(Ta + n, Ta + len, 0.0);
 
     for (size_t i = 0; i < m; i++) {
         Qra[i] = Q[m - i - 1];
     }
+    std::fill(Qra + m, Qra + len, 0.0);
 
-    pocketfft::r2c({n * 2}, {sizeof(double)}, {sizeof(std::complex<double>)}, 0, true, Qra.data(),
-                   Qraf.data(), 1.0);
+    // Both transforms are computed in place in halfcomplex order: the real part of bin 0, the
+    // real and imaginary parts of bins 1, 2, ..., and the real part of bin len / 2 if len is even
+    ws.plan->exec(Qra, 1.0, true);
+    ws.plan->exec(Ta, 1.0, true);
 
-    pocketfft::r2c({n * 2}, {sizeof(double)}, {sizeof(std::complex<double>)}, 0, true, Ta.data(),
-                   Taf.data(), 1.0);
-
-    for (size_t i = 0; i < n + 1; i++) {
-        Qraf[i] *= Taf[i];
+    Qra[0] *= Ta[0];
+    for (size_t i = 1; i + 1 < len; i += 2) {
+        std::complex<double> product = std::complex<double>(Qra[i], Qra[i + 1]) *
+                                       std::complex<double>(Ta[i], Ta[i + 1]);
+        Qra[i] = product.real();
+        Qra[i + 1] = product.imag();
+    }
+    if (len % 2 == 0) {
+        Qra[len - 1] *= Ta[len - 1];
     }
 
-    pocketfft::c2r({n * 2}, {sizeof(std::complex<double>)}, {sizeof(double)}, 0, false, Qraf.data(),
-                   Qra.data(), 1.0 / (n * 2));
+    ws.plan->exec(Qra, 1.0 / len, false);
 
     for (size_t i = m - 1; i < n; i++) {
         QT[i - m + 1] = Qra[i];
@@ -48,3 +96,43 @@ void sliding_dot_product_naive(const double *T, const double *Q, double *QT, siz
         }
     }
 }
+
+void sliding_dot_product(const double *T, const double *Q, double *QT, size_t n, size_t m,
+                         DotProductWorkspace *workspace)
+{
+    if (use_fft(n, m)) {
+        sliding_dot_product_fft(T, Q, QT, n, m, workspace);
+    } else {
+        sliding_dot_product_naive(T, Q, QT, n, m);
+    }
+}
+
+void sliding_dot_product(const float *T, const float *Q, float *QT, size_t n, size_t m,
+                         DotProductWorkspace *workspace)
+{
+    DotProductWorkspace local;
+    DotProductWorkspace &ws = workspace ? *workspace : local;
+
+    // Single-precision inputs are widened, so that seeds of the STOMP recurrence are accurate
+    ws.T.assign(T, T + n);
+    ws.Q.assign(Q, Q + m);
+    ws.QT.resize(n - m + 1);
+
+    sliding_dot_product(ws.T.data(), ws.Q.data(), ws.QT.data(), n, m, &ws);
+
+    for (size_t i = 0; i < n - m + 1; i++) {
+        QT[i] = ws.QT[i];
+    }
+}
+
+void prepare_sliding_dot_product(DotProductWorkspace &workspace, size_t n, size_t m, bool single)
+{
+    if (single) {
+        workspace.T.reserve(n);
+        workspace.Q.reserve(m);
+        workspace.QT.reserve(n - m + 1);
+    }
+    if (use_fft(n, m)) {
+        prepare_fft(workspace, n);
+    }
+}
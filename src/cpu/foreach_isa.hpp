@@ -0,0 +1,27 @@
+// Include the file named by QUICKMP_SIMD_INCLUDE once per instruction set. Each copy is placed
+// in namespace QUICKMP_SIMD_NAMESPACE (generic, avx2 or avx512) and compiled for that instruction
+// set only. The included file must not include any headers itself.
+//
+// No include guard: this file is meant to be included multiple times.
+
+#include "cpu/simd.hpp"
+
+#define QUICKMP_SIMD_NAMESPACE generic
+#include QUICKMP_SIMD_INCLUDE
+#undef QUICKMP_SIMD_NAMESPACE
+
+#if QUICKMP_SIMD_X86
+QUICKMP_BEGIN_AVX2
+#define QUICKMP_SIMD_NAMESPACE avx2
+#include QUICKMP_SIMD_INCLUDE
+#undef QUICKMP_SIMD_NAMESPACE
+QUICKMP_END_TARGET
+
+QUICKMP_BEGIN_AVX512
+#define QUICKMP_SIMD_NAMESPACE avx512
+#include QUICKMP_SIMD_INCLUDE
+#undef QUICKMP_SIMD_NAMESPACE
+QUICKMP_END_TARGET
+#endif
+
+#undef QUICKMP_SIMD_INCLUDE
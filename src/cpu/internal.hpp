@@ -1,15 +1,97 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "host_pool.hpp"
+
+namespace pocketfft {
+namespace detail {
+template <typename T0>
+class pocketfft_r;
+} // namespace detail
+} // namespace pocketfft
+
+// Scratch buffers of sliding_dot_product. Passing the same workspace to consecutive calls avoids
+// reallocating them, and recomputing the FFT plan as long as the length of T does not change.
+struct DotProductWorkspace {
+    // Double-precision copies of single-precision arguments
+    quickmp::host_vector<double> T, Q, QT;
+    // Zero-padded T and reversed Q, transformed in place
+    quickmp::host_vector<double> Ta, Qra;
+    std::shared_ptr<pocketfft::detail::pocketfft_r<double>> plan;
+};
 
 // Internal implementation functions for CPU backend
-void sliding_dot_product_fft(const double *T, const double *Q, double *QT, size_t n, size_t m);
+void sliding_dot_product_fft(const double *T, const double *Q, double *QT, size_t n, size_t m,
+                             DotProductWorkspace *workspace = nullptr);
 void sliding_dot_product_naive(const double *T, const double *Q, double *QT, size_t n, size_t m);
-void compute_mean_std(const double *T, double *mu, double *sigma, size_t n, size_t m);
-void compute_squared_sum(const double *T, double *sum, size_t n, size_t m);
-void selfjoin(const double *T, double *P, size_t n, size_t m);
-void abjoin(const double *T1, const double *T2, double *P, size_t n1, size_t n2, size_t m);
+// Selects the naive or FFT-based algorithm by estimated cost
+void sliding_dot_product(const double *T, const double *Q, double *QT, size_t n, size_t m,
+                         DotProductWorkspace *workspace = nullptr);
+void sliding_dot_product(const float *T, const float *Q, float *QT, size_t n, size_t m,
+                         DotProductWorkspace *workspace = nullptr);
+// Allocate the buffers and FFT plan that sliding_dot_product needs for these arguments
+// single: true if the arguments are single precision
+void prepare_sliding_dot_product(DotProductWorkspace &workspace, size_t n, size_t m, bool single);
+
+// The following are instantiated for float and double
+template <typename Scalar>
+void compute_mean_std(const Scalar *T, Scalar *mu, Scalar *sigma, size_t n, size_t m);
+template <typename Scalar>
+void compute_squared_sum(const Scalar *T, Scalar *sum, size_t n, size_t m);
+
+// Scratch buffers of the join functions below. Passing the same workspace to consecutive calls
+// avoids reallocating them for every time series; otherwise they are recycled by the host memory
+// pool.
+template <typename Scalar>
+struct Workspace {
+    // Centered copies of the time series (single precision only)
+    quickmp::host_vector<Scalar> Tc1, Tc2;
+    quickmp::host_vector<Scalar> QT_row, QT_col;
+    quickmp::host_vector<Scalar> mu1, sigma_inv1, mu2, sigma_inv2;
+    quickmp::host_vector<Scalar> S1, S2;
+    // Tiles of diagonals and single-threaded tile scratch (see cpu/join.hpp)
+    std::vector<std::pair<size_t, size_t>> tiles;
+    quickmp::host_vector<Scalar> qt;
+    quickmp::host_vector<double> acc;
+    DotProductWorkspace dot;
+};
+
+// I: index of the nearest neighbor of each subsequence (may be null)
+// num_threads: number of threads the distance matrix is split across
+// workspace: scratch buffers to reuse (may be null)
+// low_memory: skip the dot product array and per-thread partial profiles, and store the inverse
+//             standard deviations in float (self-joins only, see selfjoin in cpu/stomp.cpp)
+template <typename Scalar>
+void selfjoin(const Scalar *T, Scalar *P, int64_t *I, size_t n, size_t m, size_t num_threads = 1,
+              Workspace<Scalar> *workspace = nullptr, bool low_memory = false);
+template <typename Scalar>
+void abjoin(const Scalar *T1, const Scalar *T2, Scalar *P, int64_t *I, size_t n1, size_t n2,
+            size_t m, size_t num_threads = 1, Workspace<Scalar> *workspace = nullptr);
+
+// Allocate everything selfjoin (or selfjoin_ed if not normalize) needs for these arguments, so
+// that single-threaded calls with the workspace do not allocate
+template <typename Scalar>
+void prepare_selfjoin(Workspace<Scalar> &workspace, size_t n, size_t m, bool normalize,
+                      size_t num_threads = 1);
 
 // Non-normalized Euclidean distance versions
-void selfjoin_ed(const double *T, double *P, size_t n, size_t m);
-void abjoin_ed(const double *T1, const double *T2, double *P, size_t n1, size_t n2, size_t m);
+template <typename Scalar>
+void selfjoin_ed(const Scalar *T, Scalar *P, int64_t *I, size_t n, size_t m,
+                 size_t num_threads = 1, Workspace<Scalar> *workspace = nullptr,
+                 bool low_memory = false);
+template <typename Scalar>
+void abjoin_ed(const Scalar *T1, const Scalar *T2, Scalar *P, int64_t *I, size_t n1, size_t n2,
+               size_t m, size_t num_threads = 1, Workspace<Scalar> *workspace = nullptr);
+
+// Select up to k motifs (smallest entries of P) or discords (largest entries) with exclusion-zone
+// suppression: positions within excl_zone of a selected entry, and of its neighbor for motifs,
+// are skipped. Entries without a neighbor (I[i] < 0) are ignored. Returns the number of entries
+// found.
+template <typename Scalar>
+size_t select_topk(const Scalar *P, const int64_t *I, size_t l, size_t k, size_t excl_zone,
+                   bool discords, int64_t *index, int64_t *neighbor, Scalar *distance);
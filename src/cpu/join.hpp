@@ -0,0 +1,456 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "cpu/device.hpp"
+#include "cpu/internal.hpp"
+#include "cpu/simd.hpp"
+#include "cpu/thread_pool.hpp"
+
+// Diagonal traversal engine shared by the STOMP kernels.
+//
+// The distance matrix between the subsequences of A (rows) and B (columns) is processed in tiles
+// of adjacent diagonals. Within a tile, rows are visited from top to bottom and the dot product of
+// each diagonal is carried from one row to the next, so the working set of a tile is a window of
+// at most TILE_WIDTH elements of every array that slides by one element per row.
+
+// Number of diagonals per tile. The per-row working set is about 64 bytes per diagonal (dot
+// product, both series, statistics and profile), so a tile stays resident in L2.
+constexpr size_t TILE_WIDTH = 2048;
+
+// Scores are maximized by the engine. For the z-normalized distance the score is the Pearson
+// correlation times m, for the Euclidean distance it is the negated squared distance.
+// Inverse standard deviations may be stored in float (Inv) to save memory in double precision.
+// Their rounding error only scales the score, by a relative 2^-23 at most.
+template <typename Scalar, typename Inv = Scalar>
+struct ZNormalizedScore {
+    const Scalar *__restrict mu_a;
+    const Inv *__restrict sigma_inv_a;
+    const Scalar *__restrict mu_b;
+    const Inv *__restrict sigma_inv_b;
+    size_t m;
+
+    Scalar operator()(Scalar qt, size_t i, size_t j) const
+    {
+        return (qt - m * mu_a[i] * mu_b[j]) * Scalar(sigma_inv_a[i]) * Scalar(sigma_inv_b[j]);
+    }
+
+    // Rounding may push the correlation of near-identical subsequences slightly above 1
+    Scalar distance(Scalar score) const
+    {
+        return std::sqrt(std::max(Scalar(2) * m * (Scalar(1) - score / m), Scalar(0)));
+    }
+};
+
+template <typename Scalar>
+struct EuclideanScore {
+    const Scalar *__restrict S_a;
+    const Scalar *__restrict S_b;
+
+    Scalar operator()(Scalar qt, size_t i, size_t j) const { return 2 * qt - S_a[i] - S_b[j]; }
+
+    Scalar distance(Scalar score) const { return std::sqrt(-score); }
+};
+
+// True if subsequence i of a self-join of l subsequences has a candidate outside the exclusion
+// zone. Those that do not keep the -inf seed of the profile; their distance must be set to
+// infinity explicitly, since converting the seed with distance() yields NaN for float under
+// -ffast-math (sqrt is lowered to x * rsqrt(x)).
+inline bool has_neighbor(size_t i, size_t l, size_t excl_zone)
+{
+    return i > excl_zone || i + excl_zone + 1 < l;
+}
+
+// Number of rows after which the dot products of a tile are recomputed from scratch. Rounding
+// errors of the recurrence grow along the diagonals, which only matters in single precision.
+template <typename Scalar>
+size_t reseed_interval(size_t m)
+{
+    if (std::is_same<Scalar, float>::value) {
+        return std::max<size_t>(1024, 32 * m);
+    }
+    return std::numeric_limits<size_t>::max();
+}
+
+// join_tile processes the tile spanning diagonals [k_begin, k_end) and rows [i_begin, i_end).
+// Diagonal k holds the pairs (i, i + k). On entry, qt[k - k_begin] must hold the dot product
+// between subsequence i_begin of A and subsequence i_begin + k of B; it is updated in place. Row
+// maxima are accumulated into PA and column maxima into PB, which may alias for self-joins. If
+// Index is true, the position of each maximum is recorded in IA and IB.
+//
+// It is defined in cpu/join_tile-inl.hpp and compiled once per instruction set.
+#define QUICKMP_SIMD_INCLUDE "cpu/join_tile-inl.hpp"
+#include "cpu/foreach_isa.hpp"
+
+template <bool RowProfile, bool ColProfile, bool Index, class Score, typename Scalar>
+using JoinTileFn = void (*)(const Score &, const Scalar *, const Scalar *, Scalar *, Scalar *,
+                            int64_t *, Scalar *, int64_t *, size_t, size_t, size_t, size_t,
+                            size_t, size_t, size_t);
+
+// Select the join_tile implementation for the instruction set of this CPU
+template <bool RowProfile, bool ColProfile, bool Index, class Score, typename Scalar>
+JoinTileFn<RowProfile, ColProfile, Index, Score, Scalar> select_join_tile()
+{
+    switch (simd_isa()) {
+#if QUICKMP_SIMD_X86
+    case SimdIsa::AVX512:
+        return &avx512::join_tile<RowProfile, ColProfile, Index, Score, Scalar>;
+    case SimdIsa::AVX2:
+        return &avx2::join_tile<RowProfile, ColProfile, Index, Score, Scalar>;
+#endif
+    default:
+        return &generic::join_tile<RowProfile, ColProfile, Index, Score, Scalar>;
+    }
+}
+
+// Compute the dot products of row i of the tile starting at diagonal k_begin from scratch.
+// Products are accumulated in double into acc, which must hold at least width elements.
+template <typename Scalar>
+void tile_dot_products(const Scalar *__restrict A, const Scalar *__restrict B,
+                       Scalar *__restrict qt, double *__restrict acc, size_t m, size_t i,
+                       size_t k_begin, size_t width)
+{
+    std::fill(acc, acc + width, 0.0);
+
+    for (size_t x = 0; x < m; x++) {
+        double a = A[i + x];
+        const Scalar *Bx = B + i + k_begin + x;
+
+        for (size_t t = 0; t < width; t++) {
+            acc[t] += a * Bx[t];
+        }
+    }
+
+    std::copy(acc, acc + width, qt);
+}
+
+// Number of tiles join_diagonals splits the diagonals into. Multithreaded joins over-decompose so
+// that threads finishing early can pick up more work.
+inline size_t tile_count(size_t num_threads)
+{
+    return num_threads <= 1 ? 1 : num_threads * 8;
+}
+
+// Split diagonals [k_first, min(k_end, lb)) into tiles of roughly equal number of distance
+// matrix elements, each at most TILE_WIDTH diagonals wide
+inline void partition_diagonals(size_t la, size_t lb, size_t k_first, size_t num_tiles,
+                                std::vector<std::pair<size_t, size_t>> &tiles,
+                                size_t k_end = std::numeric_limits<size_t>::max())
+{
+    tiles.clear();
+    k_end = std::min(k_end, lb);
+
+    size_t total = 0;
+    for (size_t k = k_first; k < k_end; k++) {
+        total += std::min(la, lb - k);
+    }
+
+    size_t target = std::max<size_t>(total / num_tiles, 1);
+    size_t k_begin = k_first;
+    size_t work = 0;
+
+    for (size_t k = k_first; k < k_end; k++) {
+        work += std::min(la, lb - k);
+
+        if (work >= target || k + 1 - k_begin == TILE_WIDTH || k + 1 == k_end) {
+            tiles.emplace_back(k_begin, k + 1);
+            k_begin = k + 1;
+            work = 0;
+        }
+    }
+}
+
+// Number of rows a thread joins before merging its windows into the profiles in low-memory mode
+// (see join_tiles)
+constexpr size_t WINDOW_ROWS = 2048;
+
+// Partial profile accumulated by one thread
+template <typename Scalar>
+struct PartialProfile {
+    quickmp::host_vector<Scalar> P;
+    quickmp::host_vector<int64_t> I;
+
+    void init(size_t l, bool index)
+    {
+        P.assign(l, -INFINITY);
+        if (index) {
+            I.assign(l, -1);
+        }
+    }
+};
+
+// Element-wise maximum of the partial profiles into P (and their positions into I if not null)
+template <typename Scalar>
+void merge_max(Scalar *P, int64_t *I, const std::vector<PartialProfile<Scalar>> &partials,
+               size_t l, size_t num_threads)
+{
+    size_t block = (l + num_threads - 1) / num_threads;
+
+    device_thread_pool().parallel_for(num_threads, [&](size_t tid) {
+        size_t begin = std::min(tid * block, l);
+        size_t end = std::min(begin + block, l);
+
+        for (const auto &partial : partials) {
+            if (I) {
+                for (size_t j = begin; j < end; j++) {
+                    if (partial.P[j] > P[j]) {
+                        P[j] = partial.P[j];
+                        I[j] = partial.I[j];
+                    }
+                }
+            } else {
+                for (size_t j = begin; j < end; j++) {
+                    P[j] = std::max(P[j], partial.P[j]);
+                }
+            }
+        }
+    });
+}
+
+// Merge the maxima in window W (and their positions in WI if I is not null) into P[0, size)
+template <typename Scalar>
+void merge_window(Scalar *P, int64_t *I, const Scalar *W, const int64_t *WI, size_t size)
+{
+    for (size_t t = 0; t < size; t++) {
+        if (W[t] > P[t]) {
+            P[t] = W[t];
+            if (I) {
+                I[t] = WI[t];
+            }
+        }
+    }
+}
+
+// Process the given tiles of diagonals of the distance matrix with num_threads threads. Each
+// tile spans at most TILE_WIDTH diagonals. QT_first[k] must hold the dot product between the
+// first subsequence of A and subsequence k of B; if QT_first is null, the first row of every tile
+// is computed from scratch instead. PA and PB must be initialized by the caller (usually to
+// -INFINITY) and may alias for self-joins. If IA or IB is not null, the positions of the maxima
+// are recorded as well (initialized to -1). Single-threaded joins take their scratch buffers from
+// workspace if it is not null.
+//
+// Multithreaded joins normally accumulate into one partial profile per thread, which costs
+// num_threads - 1 copies of each profile. With low_memory, threads instead accumulate
+// WINDOW_ROWS rows at a time into windows over the rows and columns they touch, and merge them
+// into PA and PB under a lock.
+template <bool RowProfile, bool ColProfile, class Score, typename Scalar>
+void join_tiles(const Score &score, const Scalar *A, const Scalar *B, const Scalar *QT_first,
+                Scalar *PA, int64_t *IA, Scalar *PB, int64_t *IB, size_t la, size_t lb, size_t m,
+                const std::vector<std::pair<size_t, size_t>> &tiles, size_t num_threads,
+                Workspace<Scalar> *workspace = nullptr, bool low_memory = false)
+{
+    bool index = IA != nullptr || IB != nullptr;
+    size_t block = reseed_interval<Scalar>(m);
+
+    // A plan may run on a device with fewer cores than the one it was created on
+    num_threads = std::min(num_threads, device_thread_pool().size() + 1);
+
+    auto join_tile_index = select_join_tile<RowProfile, ColProfile, true, Score, Scalar>();
+    auto join_tile_noindex = select_join_tile<RowProfile, ColProfile, false, Score, Scalar>();
+
+    auto join_rows = [&](size_t k_begin, size_t k_end, size_t i_begin, size_t i_end, Scalar *qt,
+                         Scalar *PA_local, int64_t *IA_local, Scalar *PB_local,
+                         int64_t *IB_local) {
+        if (index) {
+            join_tile_index(score, A, B, qt, PA_local, IA_local, PB_local, IB_local, la, lb, m,
+                            k_begin, k_end, i_begin, i_end);
+        } else {
+            join_tile_noindex(score, A, B, qt, PA_local, nullptr, PB_local, nullptr, la, lb, m,
+                              k_begin, k_end, i_begin, i_end);
+        }
+    };
+
+    // Windows of one thread in low-memory mode, and the lock protecting PA and PB
+    struct Windows {
+        quickmp::host_vector<Scalar> PA, PB;
+        quickmp::host_vector<int64_t> IA, IB;
+    };
+    std::mutex merge_mutex;
+
+    // Join rows [i_begin, i_end) of a tile in slices of WINDOW_ROWS rows. Each slice starts at the
+    // last row of the previous one, which is joined again (harmlessly) so that the kernel carries
+    // the dot products over from it.
+    auto join_windowed = [&](size_t k_begin, size_t k_end, size_t i_begin, size_t i_end,
+                             Scalar *qt, Windows &w) {
+        i_end = std::min({i_end, la, lb - k_begin});
+
+        for (size_t s_begin = i_begin;; s_begin = std::min(s_begin + WINDOW_ROWS, i_end) - 1) {
+            size_t s_end = std::min(s_begin + WINDOW_ROWS, i_end);
+
+            // Rows [s_begin, s_end) touch columns [c_begin, c_end)
+            size_t rows = s_end - s_begin;
+            size_t c_begin = s_begin + k_begin;
+            size_t c_end = std::min(lb, s_end - 1 + k_end);
+
+            if (RowProfile) {
+                std::fill(w.PA.begin(), w.PA.begin() + rows, -INFINITY);
+            }
+            if (ColProfile) {
+                std::fill(w.PB.begin(), w.PB.begin() + (c_end - c_begin), -INFINITY);
+            }
+
+            // The kernel indexes the windows by row and column
+            auto shift = [](auto &window, size_t offset) {
+                return window.empty() ? nullptr : window.data() - offset;
+            };
+            join_rows(k_begin, k_end, s_begin, s_end, qt, shift(w.PA, s_begin),
+                      shift(w.IA, s_begin), shift(w.PB, c_begin), shift(w.IB, c_begin));
+
+            {
+                std::lock_guard<std::mutex> lock(merge_mutex);
+                if (RowProfile) {
+                    merge_window(PA + s_begin, IA ? IA + s_begin : nullptr, w.PA.data(),
+                                 w.IA.data(), rows);
+                }
+                if (ColProfile) {
+                    merge_window(PB + c_begin, IB ? IB + c_begin : nullptr, w.PB.data(),
+                                 w.IB.data(), c_end - c_begin);
+                }
+            }
+
+            if (s_end == i_end) {
+                break;
+            }
+        }
+    };
+
+    auto process = [&](const std::pair<size_t, size_t> &tile, Scalar *qt, double *acc,
+                       Scalar *PA_local, int64_t *IA_local, Scalar *PB_local, int64_t *IB_local,
+                       Windows *windows) {
+        size_t k_begin = tile.first;
+        size_t k_end = tile.second;
+        size_t rows = std::min(la, lb - k_begin);
+
+        // Tiles are split into blocks of rows that are seeded independently
+        for (size_t i_begin = 0; i_begin < rows; i_begin += std::min(block, rows - i_begin)) {
+            size_t i_end = i_begin + std::min(block, rows - i_begin);
+
+            if (i_begin == 0 && QT_first) {
+                std::copy(QT_first + k_begin, QT_first + k_end, qt);
+            } else {
+                size_t width = std::min(k_end, lb - i_begin) - k_begin;
+                tile_dot_products(A, B, qt, acc, m, i_begin, k_begin, width);
+            }
+
+            if (windows) {
+                join_windowed(k_begin, k_end, i_begin, i_end, qt, *windows);
+            } else {
+                join_rows(k_begin, k_end, i_begin, i_end, qt, PA_local, IA_local, PB_local,
+                          IB_local);
+            }
+        }
+    };
+
+    // Scratch for seeding, only needed when tiles are split into row blocks or there is no
+    // QT_first
+    size_t acc_size = block < la || !QT_first ? TILE_WIDTH : 0;
+
+    if (num_threads <= 1) {
+        Workspace<Scalar> local;
+        Workspace<Scalar> &ws = workspace ? *workspace : local;
+        ws.qt.resize(TILE_WIDTH);
+        ws.acc.resize(acc_size);
+
+        for (const auto &tile : tiles) {
+            process(tile, ws.qt.data(), ws.acc.data(), PA, IA, PB, IB, nullptr);
+        }
+        return;
+    }
+
+    if (low_memory) {
+        std::atomic<size_t> next_tile(0);
+
+        device_thread_pool().parallel_for(num_threads, [&](size_t) {
+            quickmp::host_vector<Scalar> qt(TILE_WIDTH);
+            quickmp::host_vector<double> acc(acc_size);
+
+            Windows windows;
+            if (RowProfile) {
+                windows.PA.resize(WINDOW_ROWS);
+                windows.IA.resize(index ? WINDOW_ROWS : 0);
+            }
+            if (ColProfile) {
+                windows.PB.resize(WINDOW_ROWS + TILE_WIDTH);
+                windows.IB.resize(index ? WINDOW_ROWS + TILE_WIDTH : 0);
+            }
+
+            for (size_t c = next_tile++; c < tiles.size(); c = next_tile++) {
+                process(tiles[c], qt.data(), acc.data(), nullptr, nullptr, nullptr, nullptr,
+                        &windows);
+            }
+        });
+        return;
+    }
+
+    std::atomic<size_t> next_tile(0);
+
+    // Each thread accumulates into its own partial profiles; thread 0 uses PA and PB directly
+    bool shared = PA == PB;
+    std::vector<PartialProfile<Scalar>> partials_a(RowProfile ? num_threads - 1 : 0);
+    std::vector<PartialProfile<Scalar>> partials_b(ColProfile && !shared ? num_threads - 1 : 0);
+
+    device_thread_pool().parallel_for(num_threads, [&](size_t tid) {
+        Scalar *PA_local = PA;
+        int64_t *IA_local = IA;
+        Scalar *PB_local = PB;
+        int64_t *IB_local = IB;
+
+        if (tid > 0 && RowProfile) {
+            PartialProfile<Scalar> &partial = partials_a[tid - 1];
+            partial.init(la, index);
+            PA_local = partial.P.data();
+            IA_local = index ? partial.I.data() : nullptr;
+        }
+        if (tid > 0 && ColProfile) {
+            if (shared) {
+                PB_local = PA_local;
+                IB_local = IA_local;
+            } else {
+                PartialProfile<Scalar> &partial = partials_b[tid - 1];
+                partial.init(lb, index);
+                PB_local = partial.P.data();
+                IB_local = index ? partial.I.data() : nullptr;
+            }
+        }
+
+        quickmp::host_vector<Scalar> qt(TILE_WIDTH);
+        quickmp::host_vector<double> acc(acc_size);
+
+        for (size_t c = next_tile++; c < tiles.size(); c = next_tile++) {
+            process(tiles[c], qt.data(), acc.data(), PA_local, IA_local, PB_local, IB_local,
+                    nullptr);
+        }
+    });
+
+    if (RowProfile) {
+        merge_max(PA, IA, partials_a, la, num_threads);
+    }
+    if (ColProfile && !shared) {
+        merge_max(PB, IB, partials_b, lb, num_threads);
+    }
+}
+
+// Process diagonals [k_first, lb) of the distance matrix with num_threads threads. See join_tiles
+// for the requirements on the arguments.
+template <bool RowProfile, bool ColProfile, class Score, typename Scalar>
+void join_diagonals(const Score &score, const Scalar *A, const Scalar *B, const Scalar *QT_first,
+                    Scalar *PA, int64_t *IA, Scalar *PB, int64_t *IB, size_t la, size_t lb,
+                    size_t m, size_t k_first, size_t num_threads,
+                    Workspace<Scalar> *workspace = nullptr, bool low_memory = false)
+{
+    Workspace<Scalar> local;
+    Workspace<Scalar> &ws = workspace ? *workspace : local;
+    partition_diagonals(la, lb, k_first, tile_count(num_threads), ws.tiles);
+
+    join_tiles<RowProfile, ColProfile>(score, A, B, QT_first, PA, IA, PB, IB, la, lb, m, ws.tiles,
+                                       num_threads, &ws, low_memory);
+}
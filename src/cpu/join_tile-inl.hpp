@@ -0,0 +1,178 @@
+// Per-instruction-set part of the tile engine. Included by cpu/join.hpp through
+// cpu/foreach_isa.hpp; do not include directly.
+
+namespace QUICKMP_SIMD_NAMESPACE {
+
+// Scores of row i, evaluated for Vec<Scalar>::width columns at a time
+template <class Score>
+struct RowScore;
+
+template <typename Scalar, typename Inv>
+struct RowScore<ZNormalizedScore<Scalar, Inv>> {
+    using V = Vec<Scalar>;
+    using Reg = typename V::Reg;
+
+    // Column statistics are copied out of the score so that they are not reloaded after every
+    // store to the profiles
+    const Scalar *__restrict mu_b;
+    const Inv *__restrict sigma_inv_b;
+    Reg m_mu_a;
+    Reg sigma_inv_a;
+
+    RowScore(const ZNormalizedScore<Scalar, Inv> &score, size_t i)
+        : mu_b(score.mu_b), sigma_inv_b(score.sigma_inv_b),
+          m_mu_a(V::set1(score.m * score.mu_a[i])), sigma_inv_a(V::set1(score.sigma_inv_a[i]))
+    {
+    }
+
+    Reg operator()(Reg qt, size_t j) const
+    {
+        Reg centered = V::fnmadd(m_mu_a, V::load(mu_b + j), qt);
+        return V::mul(V::mul(centered, sigma_inv_a), V::load(sigma_inv_b + j));
+    }
+};
+
+template <typename Scalar>
+struct RowScore<EuclideanScore<Scalar>> {
+    using V = Vec<Scalar>;
+    using Reg = typename V::Reg;
+
+    const Scalar *__restrict S_b;
+    Reg neg_S_a;
+
+    RowScore(const EuclideanScore<Scalar> &score, size_t i)
+        : S_b(score.S_b), neg_S_a(V::set1(-score.S_a[i]))
+    {
+    }
+
+    Reg operator()(Reg qt, size_t j) const
+    {
+        return V::sub(V::fmadd(V::set1(Scalar(2)), qt, neg_S_a), V::load(S_b + j));
+    }
+};
+
+// See join_tile in cpu/join.hpp
+template <bool RowProfile, bool ColProfile, bool Index, class Score, typename Scalar>
+void join_tile(const Score &score, const Scalar *__restrict A, const Scalar *__restrict B,
+               Scalar *__restrict qt, Scalar *PA, int64_t *IA, Scalar *PB, int64_t *IB,
+               size_t la, size_t lb, size_t m, size_t k_begin, size_t k_end, size_t i_begin,
+               size_t i_end)
+{
+    using V = Vec<Scalar>;
+    using Reg = typename V::Reg;
+    using Mask = typename V::Mask;
+    constexpr size_t W = V::width;
+
+    i_end = std::min({i_end, la, lb - k_begin});
+
+    for (size_t i = i_begin; i < i_end; i++) {
+        size_t width = std::min(k_end, lb - i) - k_begin;
+        size_t j_begin = i + k_begin;
+        size_t t = 0;
+
+        if (i > i_begin) {
+            Scalar A_first = A[i - 1];
+            Scalar A_last = A[i + m - 1];
+            const Scalar *B_first = B + j_begin - 1;
+            const Scalar *B_last = B + j_begin + m - 1;
+
+            Reg A_first_v = V::set1(A_first);
+            Reg A_last_v = V::set1(A_last);
+
+            for (; t + W <= width; t += W) {
+                Reg q = V::fnmadd(V::load(B_first + t), A_first_v, V::load(qt + t));
+                V::store(qt + t, V::fmadd(V::load(B_last + t), A_last_v, q));
+            }
+            for (; t < width; t++) {
+                qt[t] = qt[t] - B_first[t] * A_first + B_last[t] * A_last;
+            }
+        }
+
+        RowScore<Score> row_score(score, i);
+
+        // Row maxima are tracked per lane along with their column offsets, which are exact as
+        // Scalar since a tile is at most TILE_WIDTH wide
+        Reg max_v = V::set1(-INFINITY);
+        Reg arg_v = V::set1(0);
+        Reg offset = V::iota();
+
+        for (t = 0; t + W <= width; t += W) {
+            size_t j = j_begin + t;
+            Reg dist = row_score(V::load(qt + t), j);
+
+            if (ColProfile && Index) {
+                Reg pb = V::load(PB + j);
+                Mask better = V::gt(dist, pb);
+                V::store(PB + j, V::blend(better, pb, dist));
+                V::store_index(IB + j, better, i);
+            } else if (ColProfile) {
+                V::store(PB + j, V::max(V::load(PB + j), dist));
+            }
+
+            if (RowProfile && Index) {
+                Mask better = V::gt(dist, max_v);
+                max_v = V::blend(better, max_v, dist);
+                arg_v = V::blend(better, arg_v, offset);
+                offset = V::add(offset, V::set1(W));
+            } else if (RowProfile) {
+                // Note: the generic version relies on -ffast-math to vectorize this reduction
+                max_v = V::max(max_v, dist);
+            }
+        }
+
+        Scalar max_pi = -INFINITY;
+        int64_t arg_pi = -1;
+
+        if (RowProfile && Index) {
+            Scalar max_lanes[W], arg_lanes[W];
+            V::store(max_lanes, max_v);
+            V::store(arg_lanes, arg_v);
+
+            // Ties are broken towards the smallest column like the scalar loop below
+            for (size_t lane = 0; lane < W; lane++) {
+                int64_t j = j_begin + static_cast<int64_t>(arg_lanes[lane]);
+
+                if (max_lanes[lane] > max_pi || (max_lanes[lane] == max_pi && j < arg_pi)) {
+                    max_pi = max_lanes[lane];
+                    arg_pi = j;
+                }
+            }
+        } else if (RowProfile) {
+            max_pi = V::reduce_max(max_v);
+        }
+
+        for (; t < width; t++) {
+            size_t j = j_begin + t;
+            Scalar dist = score(qt[t], i, j);
+
+            if (ColProfile && Index) {
+                if (dist > PB[j]) {
+                    PB[j] = dist;
+                    IB[j] = i;
+                }
+            } else if (ColProfile) {
+                PB[j] = std::max(PB[j], dist);
+            }
+
+            if (RowProfile && Index) {
+                if (dist > max_pi) {
+                    max_pi = dist;
+                    arg_pi = j;
+                }
+            } else if (RowProfile) {
+                max_pi = std::max(max_pi, dist);
+            }
+        }
+
+        if (RowProfile && Index) {
+            if (max_pi > PA[i]) {
+                PA[i] = max_pi;
+                IA[i] = arg_pi;
+            }
+        } else if (RowProfile) {
+            PA[i] = std::max(PA[i], max_pi);
+        }
+    }
+}
+
+} // namespace QUICKMP_SIMD_NAMESPACE
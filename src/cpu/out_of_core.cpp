@@ -0,0 +1,538 @@
+#include "quickmp.hpp"
+#include "cpu/device.hpp"
+#include "cpu/internal.hpp"
+#include "cpu/block.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Resident bytes per subsequence of a block: time series and statistics of the row and column
+// blocks, the profiles of both accumulated for the current pair of blocks, the profile of the
+// row block accumulated over all pairs, and the pages of the output files merged into
+constexpr size_t BYTES_PER_SUBSEQUENCE = 128;
+
+[[noreturn]] void throw_file_error(const char *what, const char *path)
+{
+    throw std::runtime_error(std::string(what) + " " + path + ": " + std::strerror(errno));
+}
+
+// File mapped into memory with mmap. Pages are read from and written to the file on demand, so
+// only the pages being accessed need to be resident.
+class MappedFile {
+public:
+    // Map an existing file read-only
+    explicit MappedFile(const char *path) : path_(path)
+    {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            throw_file_error("Cannot open", path);
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw_file_error("Cannot stat", path);
+        }
+
+        map(fd, st.st_size, false);
+    }
+
+    // Create (or truncate) a file of size bytes and map it read-write
+    MappedFile(const char *path, size_t size) : path_(path)
+    {
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw_file_error("Cannot create", path);
+        }
+        if (ftruncate(fd, size) != 0) {
+            close(fd);
+            throw_file_error("Cannot resize", path);
+        }
+
+        map(fd, size, true);
+    }
+
+    ~MappedFile()
+    {
+        if (data_) {
+            munmap(data_, size_);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+    // Start reading [offset, offset + length) from the file in the background
+    void prefetch(size_t offset, size_t length) const { advise(offset, length, MADV_WILLNEED); }
+
+    // Drop [offset, offset + length) from the resident memory of the process. Modified pages are
+    // written back to the file first (in the background).
+    void evict(size_t offset, size_t length) const
+    {
+        if (writable_) {
+            sync_range(offset, length);
+        }
+        advise(offset, length, MADV_DONTNEED);
+    }
+
+private:
+    void map(int fd, size_t size, bool writable)
+    {
+        size_ = size;
+        writable_ = writable;
+
+        if (size > 0) {
+            int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+            void *data = mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                close(fd);
+                throw_file_error("Cannot map", path_);
+            }
+            data_ = static_cast<char *>(data);
+        }
+
+        close(fd);
+    }
+
+    // Expand [offset, offset + length) to page boundaries, clipped to the mapping
+    bool page_range(size_t offset, size_t length, char *&begin, size_t &bytes) const
+    {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t end = std::min(offset + length, size_);
+
+        offset = offset / page * page;
+        if (offset >= end) {
+            return false;
+        }
+
+        begin = data_ + offset;
+        bytes = end - offset;
+        return true;
+    }
+
+    void advise(size_t offset, size_t length, int advice) const
+    {
+        char *begin;
+        size_t bytes;
+        if (page_range(offset, length, begin, bytes)) {
+            madvise(begin, bytes, advice);
+        }
+    }
+
+    void sync_range(size_t offset, size_t length) const
+    {
+        char *begin;
+        size_t bytes;
+        if (page_range(offset, length, begin, bytes)) {
+            msync(begin, bytes, MS_ASYNC);
+        }
+    }
+
+    const char *path_;
+    char *data_ = nullptr;
+    size_t size_ = 0;
+    bool writable_ = false;
+};
+
+bool is_npy(const char *path)
+{
+    size_t len = std::strlen(path);
+    return len >= 4 && std::strcmp(path + len - 4, ".npy") == 0;
+}
+
+// Value of key in the header dictionary of a .npy file, as written (e.g. "'<f8'" or "(10,)")
+std::string npy_value(const std::string &header, const char *key)
+{
+    size_t pos = header.find(std::string("'") + key + "'");
+    if (pos == std::string::npos || (pos = header.find(':', pos)) == std::string::npos ||
+        (pos = header.find_first_not_of(' ', pos + 1)) == std::string::npos) {
+        return "";
+    }
+
+    size_t end = header[pos] == '(' ? header.find(')', pos) + 1 : header.find_first_of(",}", pos);
+    return header.substr(pos, end - pos);
+}
+
+// Parse the shape of a 1-D array, "(length,)"
+bool parse_npy_shape(const std::string &shape, size_t &length)
+{
+    const char *p = shape.c_str();
+    char *end;
+
+    if (*p++ != '(' || !std::isdigit(static_cast<unsigned char>(*p))) {
+        return false;
+    }
+    length = std::strtoull(p, &end, 10);
+
+    return std::strcmp(end, ",)") == 0 || std::strcmp(end, ")") == 0;
+}
+
+// Header of a .npy file holding a 1-D array of length elements of type descr. The data starts
+// at a multiple of 64 bytes.
+std::string npy_header(const char *descr, size_t length)
+{
+    std::string dict = std::string("{'descr': '") + descr + "', 'fortran_order': False, " +
+                       "'shape': (" + std::to_string(length) + ",), }";
+    size_t total = 10 + dict.size() + 1;
+    dict.append((64 - total % 64) % 64, ' ');
+    dict += '\n';
+
+    std::string header("\x93NUMPY\x01\x00", 8);
+    header += static_cast<char>(dict.size() & 0xff);
+    header += static_cast<char>(dict.size() >> 8);
+
+    return header + dict;
+}
+
+// 1-D array of T stored in a memory-mapped file: a .npy file, or raw values in native byte order
+// for any other extension
+template <typename T>
+class ArrayFile {
+public:
+    // Open an existing array
+    explicit ArrayFile(const char *path) : file_(path)
+    {
+        const char *data = file_.data();
+        size_t size = file_.size();
+
+        if (is_npy(path)) {
+            if (size < 10 || std::memcmp(data, "\x93NUMPY", 6) != 0) {
+                throw std::runtime_error(std::string("Not a .npy file: ") + path);
+            }
+
+            // Header length is 2 bytes in version 1 and 4 bytes in later versions
+            size_t header_length;
+            if (data[6] == 1) {
+                header_length = uint8_t(data[8]) | uint8_t(data[9]) << 8;
+                offset_ = 10;
+            } else {
+                header_length = uint8_t(data[8]) | uint8_t(data[9]) << 8 |
+                                uint8_t(data[10]) << 16 | size_t(uint8_t(data[11])) << 24;
+                offset_ = 12;
+            }
+            if (offset_ + header_length > size) {
+                throw std::runtime_error(std::string("Truncated .npy file: ") + path);
+            }
+
+            std::string header(data + offset_, header_length);
+            offset_ += header_length;
+
+            if (npy_value(header, "descr") != std::string("'") + descr() + "'" ||
+                !parse_npy_shape(npy_value(header, "shape"), length_)) {
+                throw std::runtime_error(std::string("Expected a 1-D ") + descr() +
+                                         " array in " + path);
+            }
+            if (offset_ + length_ * sizeof(T) > size) {
+                throw std::runtime_error(std::string("Truncated .npy file: ") + path);
+            }
+        } else {
+            if (size % sizeof(T) != 0) {
+                throw std::runtime_error(std::string("File size of ") + path +
+                                         " is not a multiple of " + std::to_string(sizeof(T)) +
+                                         " bytes.");
+            }
+            offset_ = 0;
+            length_ = size / sizeof(T);
+        }
+    }
+
+    // Create a new array of length elements
+    ArrayFile(const char *path, size_t length) : ArrayFile(path, length, header(path, length)) {}
+
+    T *data() const { return reinterpret_cast<T *>(file_.data() + offset_); }
+    size_t size() const { return length_; }
+
+    // See MappedFile. Ranges are given in elements.
+    void prefetch(size_t begin, size_t count) const
+    {
+        file_.prefetch(offset_ + begin * sizeof(T), count * sizeof(T));
+    }
+    void evict(size_t begin, size_t count) const
+    {
+        file_.evict(offset_ + begin * sizeof(T), count * sizeof(T));
+    }
+
+private:
+    ArrayFile(const char *path, size_t length, const std::string &header)
+        : file_(path, header.size() + length * sizeof(T)), offset_(header.size()), length_(length)
+    {
+        std::memcpy(file_.data(), header.data(), header.size());
+    }
+
+    static const char *descr() { return std::is_same<T, double>::value ? "<f8" : "<i8"; }
+
+    // Header of a new file (empty for raw files)
+    static std::string header(const char *path, size_t length)
+    {
+        return is_npy(path) ? npy_header(descr(), length) : std::string();
+    }
+
+    MappedFile file_;
+    size_t offset_;
+    size_t length_;
+};
+
+// Number of subsequences per block for the given memory budget. Blocks must be longer than the
+// exclusion zone, so that it only spans adjacent blocks.
+size_t block_length(size_t memory_budget, size_t m)
+{
+    return std::max({memory_budget / BYTES_PER_SUBSEQUENCE, 4 * m, TILE_WIDTH});
+}
+
+size_t series_length(const ArrayFile<double> &input, size_t m)
+{
+    if (m == 0 || input.size() < m) {
+        throw std::runtime_error("Time series must be at least as long as the window size.");
+    }
+    return input.size() - m + 1;
+}
+
+// The distance matrix is processed in pairs of blocks of B subsequences: for every row block r,
+// the diagonal block and all blocks c > r to its right. Only the time series, statistics and
+// profiles of the two blocks are resident. Column profiles are merged into the output file as
+// scores after every pair; the row profile is accumulated in memory and is final, and converted
+// to distances, once all pairs of its row are done. The time series of the next block is
+// prefetched while the current pair is joined.
+template <class Score>
+void selfjoin_file_impl(const ArrayFile<double> &input, const ArrayFile<double> &P_file,
+                        const ArrayFile<int64_t> *I_file, size_t m, size_t num_threads,
+                        size_t memory_budget)
+{
+    const double *T = input.data();
+    size_t l = series_length(input, m);
+    size_t excl_zone = std::ceil(m / 4.0);
+    size_t B = block_length(memory_budget, m);
+    size_t num_blocks = (l + B - 1) / B;
+    bool index = I_file != nullptr;
+    bool normalize = std::is_same<Score, ZNormalizedScore<double>>::value;
+
+    double *P = P_file.data();
+    int64_t *I = index ? I_file->data() : nullptr;
+
+    auto prefetch = [&](size_t block) {
+        if (block < num_blocks) {
+            size_t begin = block * B;
+            size_t length = std::min(B, l - begin);
+            input.prefetch(begin, length + m - 1);
+            P_file.prefetch(begin, length);
+            if (index) {
+                I_file->prefetch(begin, length);
+            }
+        }
+    };
+
+    // Evict each chunk of the output after initializing it
+    for (size_t begin = 0; begin < l; begin += B) {
+        size_t count = std::min(B, l - begin);
+        std::fill(P + begin, P + begin + count, -INFINITY);
+        P_file.evict(begin, count);
+        if (index) {
+            std::fill(I + begin, I + begin + count, -1);
+            I_file->evict(begin, count);
+        }
+    }
+
+    Block row, col;
+    BlockProfile acc, prow, pcol;
+    Workspace<double> ws;
+
+    for (size_t r = 0; r < num_blocks; r++) {
+        size_t rb = r * B;
+        row.load(T, rb, std::min(B, l - rb), m, normalize);
+
+        // Start from the column profiles merged by the pairs of earlier rows
+        acc.P.assign(P + rb, P + rb + row.length);
+        if (index) {
+            acc.I.assign(I + rb, I + rb + row.length);
+        }
+
+        prefetch(r + 1);
+
+        Score score_rr = block_score<Score>(row, row, m);
+        prow.reset(row.length, index);
+        join_blocks<true, true>(score_rr, row, row, &prow, &prow, index, m, excl_zone + 1,
+                                row.length, num_threads, ws);
+        merge_block(acc.P.data(), index ? acc.I.data() : nullptr, prow, row.length, rb);
+
+        for (size_t c = r + 1; c < num_blocks; c++) {
+            size_t cb = c * B;
+            size_t length = std::min(B, l - cb);
+
+            // The next column block, or the first one of the next row
+            prefetch(c + 1 < num_blocks ? c + 1 : r + 2);
+
+            col.load(T, cb, length, m, normalize);
+            prow.reset(row.length, index);
+            pcol.reset(col.length, index);
+
+            // Pairs (i, j) with j >= i. The distance between them is at least B, which is outside
+            // the exclusion zone.
+            Score score_rc = block_score<Score>(row, col, m);
+            join_blocks<true, true>(score_rc, row, col, &prow, &pcol, index, m, 0, col.length,
+                                    num_threads, ws);
+
+            // Pairs (i, j) with j < i, on diagonal i - j of the transposed block. For adjacent
+            // blocks, their distance is B - (i - j), which is in the exclusion zone from diagonal
+            // B - excl_zone on.
+            Score score_cr = block_score<Score>(col, row, m);
+            size_t k_end = c == r + 1 ? B - excl_zone : row.length;
+            join_blocks<true, true>(score_cr, col, row, &pcol, &prow, index, m, 1, k_end,
+                                    num_threads, ws);
+
+            merge_block(acc.P.data(), index ? acc.I.data() : nullptr, prow, row.length, cb);
+            merge_block(P + cb, index ? I + cb : nullptr, pcol, col.length, rb);
+
+            input.evict(cb, col.length + m - 1);
+            P_file.evict(cb, col.length);
+            if (index) {
+                I_file->evict(cb, col.length);
+            }
+        }
+
+        for (size_t t = 0; t < row.length; t++) {
+            P[rb + t] = has_neighbor(rb + t, l, excl_zone) ? score_rr.distance(acc.P[t])
+                                                           : INFINITY;
+        }
+        if (index) {
+            std::copy(acc.I.begin(), acc.I.end(), I + rb);
+        }
+
+        input.evict(rb, row.length + m - 1);
+        P_file.evict(rb, row.length);
+        if (index) {
+            I_file->evict(rb, row.length);
+        }
+    }
+}
+
+// Every block of T1 (rows) is joined with all blocks of T2 (columns) in turn. Only the row
+// profile is needed, so it is accumulated in memory and written once.
+template <class Score>
+void abjoin_file_impl(const ArrayFile<double> &input1, const ArrayFile<double> &input2,
+                      const ArrayFile<double> &P_file, const ArrayFile<int64_t> *I_file,
+                      size_t m, size_t num_threads, size_t memory_budget)
+{
+    const double *T1 = input1.data();
+    const double *T2 = input2.data();
+    size_t l1 = series_length(input1, m);
+    size_t l2 = series_length(input2, m);
+    size_t B = block_length(memory_budget, m);
+    bool index = I_file != nullptr;
+    bool normalize = std::is_same<Score, ZNormalizedScore<double>>::value;
+
+    double *P = P_file.data();
+    int64_t *I = index ? I_file->data() : nullptr;
+
+    Block row, col;
+    BlockProfile acc, prow;
+    Workspace<double> ws;
+
+    for (size_t rb = 0; rb < l1; rb += B) {
+        row.load(T1, rb, std::min(B, l1 - rb), m, normalize);
+        acc.reset(row.length, index);
+
+        for (size_t cb = 0; cb < l2; cb += B) {
+            size_t next = cb + B < l2 ? cb + B : 0;
+            input2.prefetch(next, std::min(B, l2 - next) + m - 1);
+
+            col.load(T2, cb, std::min(B, l2 - cb), m, normalize);
+            prow.reset(row.length, index);
+
+            // Diagonals on and above the main diagonal: rows are subsequences of T2, columns of T1
+            Score score_cr = block_score<Score>(col, row, m);
+            join_blocks<false, true>(score_cr, col, row, nullptr, &prow, index, m, 0, row.length,
+                                     num_threads, ws);
+
+            // Diagonals below the main diagonal, traversed on the transposed block
+            Score score_rc = block_score<Score>(row, col, m);
+            join_blocks<true, false>(score_rc, row, col, &prow, nullptr, index, m, 1, col.length,
+                                     num_threads, ws);
+
+            merge_block(acc.P.data(), index ? acc.I.data() : nullptr, prow, row.length, cb);
+
+            input2.evict(cb, col.length + m - 1);
+        }
+
+        Score score = block_score<Score>(row, row, m);
+        for (size_t t = 0; t < row.length; t++) {
+            P[rb + t] = score.distance(acc.P[t]);
+        }
+        if (index) {
+            std::copy(acc.I.begin(), acc.I.end(), I + rb);
+        }
+
+        input1.evict(rb, row.length + m - 1);
+        P_file.evict(rb, row.length);
+        if (index) {
+            I_file->evict(rb, row.length);
+        }
+    }
+}
+
+} // anonymous namespace
+
+namespace quickmp {
+
+void selfjoin_file(const char *input, const char *output, const char *output_index, size_t m,
+                   bool normalize, int num_threads, size_t memory_budget) {
+    size_t threads = resolve_num_threads(num_threads);
+
+    ArrayFile<double> T(input);
+    size_t l = series_length(T, m);
+
+    ArrayFile<double> P(output, l);
+    std::unique_ptr<ArrayFile<int64_t>> I;
+    if (output_index) {
+        I.reset(new ArrayFile<int64_t>(output_index, l));
+    }
+
+    if (normalize) {
+        selfjoin_file_impl<ZNormalizedScore<double>>(T, P, I.get(), m, threads, memory_budget);
+    } else {
+        selfjoin_file_impl<EuclideanScore<double>>(T, P, I.get(), m, threads, memory_budget);
+    }
+}
+
+void abjoin_file(const char *input1, const char *input2, const char *output,
+                 const char *output_index, size_t m, bool normalize, int num_threads,
+                 size_t memory_budget) {
+    size_t threads = resolve_num_threads(num_threads);
+
+    ArrayFile<double> T1(input1);
+    ArrayFile<double> T2(input2);
+    size_t l1 = series_length(T1, m);
+    series_length(T2, m);
+
+    ArrayFile<double> P(output, l1);
+    std::unique_ptr<ArrayFile<int64_t>> I;
+    if (output_index) {
+        I.reset(new ArrayFile<int64_t>(output_index, l1));
+    }
+
+    if (normalize) {
+        abjoin_file_impl<ZNormalizedScore<double>>(T1, T2, P, I.get(), m, threads,
+                                                   memory_budget);
+    } else {
+        abjoin_file_impl<EuclideanScore<double>>(T1, T2, P, I.get(), m, threads, memory_budget);
+    }
+}
+
+} // namespace quickmp
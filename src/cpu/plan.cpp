@@ -0,0 +1,60 @@
+#include "quickmp.hpp"
+#include "cpu/device.hpp"
+#include "cpu/internal.hpp"
+
+#include <stdexcept>
+
+namespace quickmp {
+
+struct Plan::Impl {
+    size_t n;
+    size_t m;
+    bool normalize;
+    size_t num_threads;
+
+    Workspace<double> workspace;
+};
+
+Plan::Plan(size_t n, size_t m, bool normalize, int num_threads) : impl_(new Impl()) {
+    if (m == 0 || n < m) {
+        throw std::runtime_error("Time series must be at least as long as the window size.");
+    }
+
+    Impl &impl = *impl_;
+    impl.n = n;
+    impl.m = m;
+    impl.normalize = normalize;
+    impl.num_threads = resolve_num_threads(num_threads);
+
+    ::prepare_selfjoin(impl.workspace, n, m, normalize, impl.num_threads);
+}
+
+Plan::~Plan() = default;
+
+Plan::Plan(Plan &&) noexcept = default;
+
+Plan &Plan::operator=(Plan &&) noexcept = default;
+
+void Plan::execute(const double *T, double *P, int64_t *I) {
+    Impl &impl = *impl_;
+
+    if (impl.normalize) {
+        ::selfjoin(T, P, I, impl.n, impl.m, impl.num_threads, &impl.workspace);
+    } else {
+        ::selfjoin_ed(T, P, I, impl.n, impl.m, impl.num_threads, &impl.workspace);
+    }
+}
+
+size_t Plan::size() const {
+    return impl_->n;
+}
+
+size_t Plan::window_size() const {
+    return impl_->m;
+}
+
+size_t Plan::profile_size() const {
+    return impl_->n - impl_->m + 1;
+}
+
+} // namespace quickmp
@@ -0,0 +1,74 @@
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#include "cpu/simd.hpp"
+
+namespace {
+
+// Instruction set of the selected backend, or -1 for the default
+std::atomic<int> g_selected_isa(-1);
+
+} // anonymous namespace
+
+SimdIsa detect_simd_isa()
+{
+#if QUICKMP_SIMD_X86
+    // __builtin_cpu_supports queries CPUID and also checks that the OS saves the wider registers
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f")) {
+        return SimdIsa::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return SimdIsa::AVX2;
+    }
+#endif
+    return SimdIsa::Generic;
+}
+
+SimdIsa default_simd_isa()
+{
+    static const SimdIsa isa = [] {
+        SimdIsa best = detect_simd_isa();
+        const char *env = std::getenv("QUICKMP_SIMD");
+
+        if (env == nullptr) {
+            return best;
+        }
+
+        // The requested instruction set is only honored if the CPU supports it
+        for (SimdIsa isa : {SimdIsa::Generic, SimdIsa::AVX2, SimdIsa::AVX512}) {
+            if (std::strcmp(env, simd_isa_name(isa)) == 0 && isa <= best) {
+                return isa;
+            }
+        }
+        return best;
+    }();
+
+    return isa;
+}
+
+SimdIsa simd_isa()
+{
+    int selected = g_selected_isa.load(std::memory_order_relaxed);
+
+    return selected >= 0 ? static_cast<SimdIsa>(selected) : default_simd_isa();
+}
+
+void select_simd_isa(SimdIsa isa)
+{
+    g_selected_isa.store(static_cast<int>(isa), std::memory_order_relaxed);
+}
+
+const char *simd_isa_name(SimdIsa isa)
+{
+    switch (isa) {
+    case SimdIsa::AVX2:
+        return "avx2";
+    case SimdIsa::AVX512:
+        return "avx512";
+    default:
+        return "generic";
+    }
+}
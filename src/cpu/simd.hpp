@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Runtime instruction set dispatch for the CPU kernels.
+//
+// The hot kernels are written once against the Vec<Scalar> wrappers below and compiled for every
+// instruction set by including them through cpu/foreach_isa.hpp, which places each copy in its
+// own namespace (generic, avx2, avx512) and enables the instruction set for that copy only. The
+// rest of the library is compiled for the baseline target, so a single binary runs everywhere
+// and picks the widest implementation supported by the CPU at runtime.
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define QUICKMP_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define QUICKMP_SIMD_X86 0
+#endif
+
+enum class SimdIsa { Generic, AVX2, AVX512 };
+
+// Instruction set used by the kernels, chosen by the backend selected in initialize()
+SimdIsa simd_isa();
+
+// Make simd_isa() return isa. Called by initialize() and finalize().
+void select_simd_isa(SimdIsa isa);
+
+// Widest instruction set supported by the CPU
+SimdIsa detect_simd_isa();
+
+// Instruction set used by default: the widest one supported by the CPU, which can be lowered by
+// setting the QUICKMP_SIMD environment variable to "generic", "avx2" or "avx512" (e.g. for
+// benchmarking)
+SimdIsa default_simd_isa();
+
+const char *simd_isa_name(SimdIsa isa);
+
+#if QUICKMP_SIMD_X86
+#if defined(__clang__)
+#define QUICKMP_BEGIN_AVX2                                                                        \
+    _Pragma("clang attribute push(__attribute__((target(\"avx2,fma\"))), apply_to = function)")
+#define QUICKMP_BEGIN_AVX512                                                                      \
+    _Pragma("clang attribute push(__attribute__((target(\"avx512f,avx2,fma\"))), "               \
+            "apply_to = function)")
+#define QUICKMP_END_TARGET _Pragma("clang attribute pop")
+#else
+#define QUICKMP_BEGIN_AVX2 _Pragma("GCC push_options") _Pragma("GCC target(\"avx2,fma\")")
+#define QUICKMP_BEGIN_AVX512                                                                      \
+    _Pragma("GCC push_options") _Pragma("GCC target(\"avx512f,avx2,fma\")")
+#define QUICKMP_END_TARGET _Pragma("GCC pop_options")
+#endif
+#endif
+
+// Vec<Scalar> exposes a vector register of width Scalars (Reg), a per-lane comparison result
+// (Mask) and the operations needed by the kernels. max(a, b) follows std::max(a, b) and returns a
+// if either operand is NaN. Vec<double> can additionally load from and store to float arrays.
+
+namespace generic {
+
+// One element per register. Loops over these are left to the auto-vectorizer, which targets the
+// baseline instruction set.
+template <typename Scalar>
+struct Vec {
+    using Reg = Scalar;
+    using Mask = bool;
+    static constexpr size_t width = 1;
+
+    template <typename T>
+    static Reg load(const T *p) { return *p; }
+    template <typename T>
+    static void store(T *p, Reg a) { *p = a; }
+    static Reg set1(Scalar x) { return x; }
+    static Reg iota() { return 0; }
+
+    static Reg add(Reg a, Reg b) { return a + b; }
+    static Reg sub(Reg a, Reg b) { return a - b; }
+    static Reg mul(Reg a, Reg b) { return a * b; }
+    static Reg fmadd(Reg a, Reg b, Reg c) { return a * b + c; }
+    static Reg fnmadd(Reg a, Reg b, Reg c) { return c - a * b; }
+    static Reg sqrt(Reg a) { return std::sqrt(a); }
+    static Reg max(Reg a, Reg b) { return std::max(a, b); }
+
+    static Mask gt(Reg a, Reg b) { return a > b; }
+    static Reg blend(Mask mask, Reg a, Reg b) { return mask ? b : a; }
+    static void store_index(int64_t *p, Mask mask, int64_t value)
+    {
+        if (mask) {
+            *p = value;
+        }
+    }
+
+    static Scalar reduce_max(Reg a) { return a; }
+    static Scalar first(Reg a) { return a; }
+    static Reg prefix_sum(Reg a) { return a; }
+    static Reg broadcast_last(Reg a) { return a; }
+};
+
+} // namespace generic
+
+#if QUICKMP_SIMD_X86
+
+QUICKMP_BEGIN_AVX2
+namespace avx2 {
+
+template <typename Scalar>
+struct Vec;
+
+template <>
+struct Vec<double> {
+    using Reg = __m256d;
+    using Mask = __m256d;
+    static constexpr size_t width = 4;
+
+    static Reg load(const double *p) { return _mm256_loadu_pd(p); }
+    static Reg load(const float *p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+    static void store(double *p, Reg a) { _mm256_storeu_pd(p, a); }
+    static void store(float *p, Reg a) { _mm_storeu_ps(p, _mm256_cvtpd_ps(a)); }
+    static Reg set1(double x) { return _mm256_set1_pd(x); }
+    static Reg iota() { return _mm256_setr_pd(0, 1, 2, 3); }
+
+    static Reg add(Reg a, Reg b) { return _mm256_add_pd(a, b); }
+    static Reg sub(Reg a, Reg b) { return _mm256_sub_pd(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm256_mul_pd(a, b); }
+    static Reg fmadd(Reg a, Reg b, Reg c) { return _mm256_fmadd_pd(a, b, c); }
+    static Reg fnmadd(Reg a, Reg b, Reg c) { return _mm256_fnmadd_pd(a, b, c); }
+    static Reg sqrt(Reg a) { return _mm256_sqrt_pd(a); }
+    static Reg max(Reg a, Reg b) { return _mm256_max_pd(b, a); }
+
+    static Mask gt(Reg a, Reg b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+    static Reg blend(Mask mask, Reg a, Reg b) { return _mm256_blendv_pd(a, b, mask); }
+    static void store_index(int64_t *p, Mask mask, int64_t value)
+    {
+        _mm256_maskstore_epi64(reinterpret_cast<long long *>(p), _mm256_castpd_si256(mask),
+                               _mm256_set1_epi64x(value));
+    }
+
+    static double reduce_max(Reg a)
+    {
+        __m128d x = _mm_max_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+        x = _mm_max_sd(x, _mm_unpackhi_pd(x, x));
+        return _mm_cvtsd_f64(x);
+    }
+
+    static double first(Reg a) { return _mm256_cvtsd_f64(a); }
+
+    // Inclusive prefix sum of the lanes
+    static Reg prefix_sum(Reg a)
+    {
+        Reg shifted = _mm256_blend_pd(_mm256_permute4x64_pd(a, 0x90), _mm256_setzero_pd(), 0x1);
+        a = _mm256_add_pd(a, shifted);
+        return _mm256_add_pd(a, _mm256_permute2f128_pd(a, a, 0x08));
+    }
+
+    static Reg broadcast_last(Reg a) { return _mm256_permute4x64_pd(a, 0xff); }
+};
+
+template <>
+struct Vec<float> {
+    using Reg = __m256;
+    using Mask = __m256;
+    static constexpr size_t width = 8;
+
+    static Reg load(const float *p) { return _mm256_loadu_ps(p); }
+    static void store(float *p, Reg a) { _mm256_storeu_ps(p, a); }
+    static Reg set1(float x) { return _mm256_set1_ps(x); }
+    static Reg iota() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+
+    static Reg add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+    static Reg sub(Reg a, Reg b) { return _mm256_sub_ps(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+    static Reg fmadd(Reg a, Reg b, Reg c) { return _mm256_fmadd_ps(a, b, c); }
+    static Reg fnmadd(Reg a, Reg b, Reg c) { return _mm256_fnmadd_ps(a, b, c); }
+    static Reg max(Reg a, Reg b) { return _mm256_max_ps(b, a); }
+
+    static Mask gt(Reg a, Reg b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static Reg blend(Mask mask, Reg a, Reg b) { return _mm256_blendv_ps(a, b, mask); }
+    static void store_index(int64_t *p, Mask mask, int64_t value)
+    {
+        // Widen the 32-bit lane masks to the 64-bit indices
+        __m256i mask32 = _mm256_castps_si256(mask);
+        __m256i lo = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(mask32));
+        __m256i hi = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(mask32, 1));
+        __m256i v = _mm256_set1_epi64x(value);
+
+        _mm256_maskstore_epi64(reinterpret_cast<long long *>(p), lo, v);
+        _mm256_maskstore_epi64(reinterpret_cast<long long *>(p + 4), hi, v);
+    }
+
+    static float reduce_max(Reg a)
+    {
+        __m128 x = _mm_max_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+        x = _mm_max_ps(x, _mm_movehl_ps(x, x));
+        x = _mm_max_ss(x, _mm_shuffle_ps(x, x, 0x1));
+        return _mm_cvtss_f32(x);
+    }
+};
+
+} // namespace avx2
+QUICKMP_END_TARGET
+
+QUICKMP_BEGIN_AVX512
+namespace avx512 {
+
+template <typename Scalar>
+struct Vec;
+
+template <>
+struct Vec<double> {
+    using Reg = __m512d;
+    using Mask = __mmask8;
+    static constexpr size_t width = 8;
+
+    static Reg load(const double *p) { return _mm512_loadu_pd(p); }
+    static Reg load(const float *p) { return _mm512_cvtps_pd(_mm256_loadu_ps(p)); }
+    static void store(double *p, Reg a) { _mm512_storeu_pd(p, a); }
+    static void store(float *p, Reg a) { _mm256_storeu_ps(p, _mm512_cvtpd_ps(a)); }
+    static Reg set1(double x) { return _mm512_set1_pd(x); }
+    static Reg iota() { return _mm512_setr_pd(0, 1, 2, 3, 4, 5, 6, 7); }
+
+    static Reg add(Reg a, Reg b) { return _mm512_add_pd(a, b); }
+    static Reg sub(Reg a, Reg b) { return _mm512_sub_pd(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm512_mul_pd(a, b); }
+    static Reg fmadd(Reg a, Reg b, Reg c) { return _mm512_fmadd_pd(a, b, c); }
+    static Reg fnmadd(Reg a, Reg b, Reg c) { return _mm512_fnmadd_pd(a, b, c); }
+    static Reg sqrt(Reg a) { return _mm512_sqrt_pd(a); }
+    static Reg max(Reg a, Reg b) { return _mm512_max_pd(b, a); }
+
+    static Mask gt(Reg a, Reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+    static Reg blend(Mask mask, Reg a, Reg b) { return _mm512_mask_blend_pd(mask, a, b); }
+    static void store_index(int64_t *p, Mask mask, int64_t value)
+    {
+        _mm512_mask_storeu_epi64(p, mask, _mm512_set1_epi64(value));
+    }
+
+    static double reduce_max(Reg a) { return _mm512_reduce_max_pd(a); }
+    static double first(Reg a) { return _mm512_cvtsd_f64(a); }
+
+    // Inclusive prefix sum of the lanes
+    static Reg prefix_sum(Reg a)
+    {
+        a = _mm512_add_pd(a, _mm512_maskz_permutexvar_pd(
+                                 0xfe, _mm512_set_epi64(6, 5, 4, 3, 2, 1, 0, 0), a));
+        a = _mm512_add_pd(a, _mm512_maskz_permutexvar_pd(
+                                 0xfc, _mm512_set_epi64(5, 4, 3, 2, 1, 0, 0, 0), a));
+        return _mm512_add_pd(a, _mm512_maskz_permutexvar_pd(
+                                    0xf0, _mm512_set_epi64(3, 2, 1, 0, 0, 0, 0, 0), a));
+    }
+
+    static Reg broadcast_last(Reg a) { return _mm512_permutexvar_pd(_mm512_set1_epi64(7), a); }
+};
+
+template <>
+struct Vec<float> {
+    using Reg = __m512;
+    using Mask = __mmask16;
+    static constexpr size_t width = 16;
+
+    static Reg load(const float *p) { return _mm512_loadu_ps(p); }
+    static void store(float *p, Reg a) { _mm512_storeu_ps(p, a); }
+    static Reg set1(float x) { return _mm512_set1_ps(x); }
+    static Reg iota()
+    {
+        return _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    }
+
+    static Reg add(Reg a, Reg b) { return _mm512_add_ps(a, b); }
+    static Reg sub(Reg a, Reg b) { return _mm512_sub_ps(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm512_mul_ps(a, b); }
+    static Reg fmadd(Reg a, Reg b, Reg c) { return _mm512_fmadd_ps(a, b, c); }
+    static Reg fnmadd(Reg a, Reg b, Reg c) { return _mm512_fnmadd_ps(a, b, c); }
+    static Reg max(Reg a, Reg b) { return _mm512_max_ps(b, a); }
+
+    static Mask gt(Reg a, Reg b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+    static Reg blend(Mask mask, Reg a, Reg b) { return _mm512_mask_blend_ps(mask, a, b); }
+    static void store_index(int64_t *p, Mask mask, int64_t value)
+    {
+        __m512i v = _mm512_set1_epi64(value);
+
+        _mm512_mask_storeu_epi64(p, static_cast<__mmask8>(mask), v);
+        _mm512_mask_storeu_epi64(p + 8, static_cast<__mmask8>(mask >> 8), v);
+    }
+
+    static float reduce_max(Reg a) { return _mm512_reduce_max_ps(a); }
+};
+
+} // namespace avx512
+QUICKMP_END_TARGET
+
+#endif
@@ -0,0 +1,121 @@
+// Per-instruction-set part of the rolling statistics. Included by cpu/stats.cpp through
+// cpu/foreach_isa.hpp; do not include directly.
+//
+// The window sums are differences of two running prefix sums: one ending at the start of the
+// window (lag) and one ending at its end (lead). Both are advanced width elements at a time with
+// an in-register prefix sum and accumulated in double regardless of Scalar.
+
+namespace QUICKMP_SIMD_NAMESPACE {
+
+template <typename Scalar>
+void compute_squared_sum(const Scalar *T, Scalar *sum, size_t n, size_t m)
+{
+    using V = Vec<double>;
+    using Reg = typename V::Reg;
+    constexpr size_t W = V::width;
+
+    size_t l = n - m + 1;
+
+    double sum_T2 = 0.0;
+    for (size_t x = 0; x < m; x++) {
+        sum_T2 += static_cast<double>(T[x]) * T[x];
+    }
+    sum[0] = sum_T2;
+
+    Reg lag_T2 = V::set1(0.0);
+    Reg lead_T2 = V::set1(sum_T2);
+
+    // Window i + 1 + lane is computed from the elements T[i + lane] and T[i + m + lane]
+    size_t i = 0;
+    for (; i + W < l; i += W) {
+        Reg x_lag = V::load(T + i);
+        Reg x_lead = V::load(T + i + m);
+
+        lag_T2 = V::add(lag_T2, V::prefix_sum(V::mul(x_lag, x_lag)));
+        lead_T2 = V::add(lead_T2, V::prefix_sum(V::mul(x_lead, x_lead)));
+
+        V::store(sum + i + 1, V::sub(lead_T2, lag_T2));
+
+        lag_T2 = V::broadcast_last(lag_T2);
+        lead_T2 = V::broadcast_last(lead_T2);
+    }
+
+    double sum_T2_lag = V::first(lag_T2);
+    sum_T2 = V::first(lead_T2);
+
+    for (; i + 1 < l; i++) {
+        sum_T2_lag += static_cast<double>(T[i]) * T[i];
+        sum_T2 += static_cast<double>(T[i + m]) * T[i + m];
+
+        sum[i + 1] = sum_T2 - sum_T2_lag;
+    }
+}
+
+template <typename Scalar>
+void compute_mean_std(const Scalar *T, Scalar *mu, Scalar *sigma, size_t n, size_t m)
+{
+    using V = Vec<double>;
+    using Reg = typename V::Reg;
+    constexpr size_t W = V::width;
+
+    size_t l = n - m + 1;
+
+    double sum_T = 0.0;
+    double sum_T2 = 0.0;
+    for (size_t x = 0; x < m; x++) {
+        sum_T += T[x];
+        sum_T2 += static_cast<double>(T[x]) * T[x];
+    }
+
+    double mu_0 = sum_T / m;
+    mu[0] = mu_0;
+    sigma[0] = std::sqrt(sum_T2 / m - mu_0 * mu_0);
+
+    Reg lag_T = V::set1(0.0);
+    Reg lag_T2 = V::set1(0.0);
+    Reg lead_T = V::set1(sum_T);
+    Reg lead_T2 = V::set1(sum_T2);
+    Reg m_inv = V::set1(1.0 / m);
+
+    // Window i + 1 + lane is computed from the elements T[i + lane] and T[i + m + lane]
+    size_t i = 0;
+    for (; i + W < l; i += W) {
+        Reg x_lag = V::load(T + i);
+        Reg x_lead = V::load(T + i + m);
+
+        lag_T = V::add(lag_T, V::prefix_sum(x_lag));
+        lag_T2 = V::add(lag_T2, V::prefix_sum(V::mul(x_lag, x_lag)));
+        lead_T = V::add(lead_T, V::prefix_sum(x_lead));
+        lead_T2 = V::add(lead_T2, V::prefix_sum(V::mul(x_lead, x_lead)));
+
+        Reg mu_i = V::mul(V::sub(lead_T, lag_T), m_inv);
+        Reg var_i = V::fnmadd(mu_i, mu_i, V::mul(V::sub(lead_T2, lag_T2), m_inv));
+
+        V::store(mu + i + 1, mu_i);
+        V::store(sigma + i + 1, V::sqrt(var_i));
+
+        lag_T = V::broadcast_last(lag_T);
+        lag_T2 = V::broadcast_last(lag_T2);
+        lead_T = V::broadcast_last(lead_T);
+        lead_T2 = V::broadcast_last(lead_T2);
+    }
+
+    double sum_T_lag = V::first(lag_T);
+    double sum_T2_lag = V::first(lag_T2);
+    sum_T = V::first(lead_T);
+    sum_T2 = V::first(lead_T2);
+
+    for (; i + 1 < l; i++) {
+        sum_T_lag += T[i];
+        sum_T2_lag += static_cast<double>(T[i]) * T[i];
+        sum_T += T[i + m];
+        sum_T2 += static_cast<double>(T[i + m]) * T[i + m];
+
+        double mu_i = (sum_T - sum_T_lag) / m;
+
+        mu[i + 1] = mu_i;
+        sigma[i + 1] = std::sqrt((sum_T2 - sum_T2_lag) / m - mu_i * mu_i);
+    }
+}
+
+} // namespace QUICKMP_SIMD_NAMESPACE
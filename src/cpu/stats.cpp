@@ -1,38 +1,49 @@
 #include <cmath>
 
-void compute_squared_sum(const double *T, double *sum, size_t n, size_t m)
-{
-    double sum_T2 = 0.0;
-    double sum_T2_lag = 0.0;
+#include "cpu/internal.hpp"
+#include "cpu/simd.hpp"
 
-    for (size_t i = 0; i < n; i++) {
-        sum_T2 += T[i] * T[i];
+#define QUICKMP_SIMD_INCLUDE "cpu/stats-inl.hpp"
+#include "cpu/foreach_isa.hpp"
 
-        if (i + 1 >= m) {
-            sum[i + 1 - m] = sum_T2 - sum_T2_lag;
+// Sums are accumulated in double regardless of Scalar, so that the single-precision versions do
+// not lose accuracy over long series
 
-            sum_T2_lag += T[i + 1 - m] * T[i + 1 - m];
-        }
+template <typename Scalar>
+void compute_squared_sum(const Scalar *T, Scalar *sum, size_t n, size_t m)
+{
+    switch (simd_isa()) {
+#if QUICKMP_SIMD_X86
+    case SimdIsa::AVX512:
+        avx512::compute_squared_sum(T, sum, n, m);
+        break;
+    case SimdIsa::AVX2:
+        avx2::compute_squared_sum(T, sum, n, m);
+        break;
+#endif
+    default:
+        generic::compute_squared_sum(T, sum, n, m);
     }
 }
 
-void compute_mean_std(const double *T, double *mu, double *sigma, size_t n, size_t m)
+template <typename Scalar>
+void compute_mean_std(const Scalar *T, Scalar *mu, Scalar *sigma, size_t n, size_t m)
 {
-    double sum_T = 0.0;
-    double sum_T_lag = 0.0;
-    double sum_T2 = 0.0;
-    double sum_T2_lag = 0.0;
-
-    for (size_t i = 0; i < n; i++) {
-        sum_T += T[i];
-        sum_T2 += T[i] * T[i];
-
-        if (i + 1 >= m) {
-            mu[i + 1 - m] = (sum_T - sum_T_lag) / m;
-            sigma[i + 1 - m] = std::sqrt((sum_T2 - sum_T2_lag) / m - mu[i + 1 - m] * mu[i + 1 - m]);
-
-            sum_T_lag += T[i + 1 - m];
-            sum_T2_lag += T[i + 1 - m] * T[i + 1 - m];
-        }
+    switch (simd_isa()) {
+#if QUICKMP_SIMD_X86
+    case SimdIsa::AVX512:
+        avx512::compute_mean_std(T, mu, sigma, n, m);
+        break;
+    case SimdIsa::AVX2:
+        avx2::compute_mean_std(T, mu, sigma, n, m);
+        break;
+#endif
+    default:
+        generic::compute_mean_std(T, mu, sigma, n, m);
     }
 }
+
+template void compute_squared_sum(const float *T, float *sum, size_t n, size_t m);
+template void compute_squared_sum(const double *T, double *sum, size_t n, size_t m);
+template void compute_mean_std(const float *T, float *mu, float *sigma, size_t n, size_t m);
+template void compute_mean_std(const double *T, double *mu, double *sigma, size_t n, size_t m);
@@ -1,254 +1,338 @@
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
 
 #include "cpu/internal.hpp"
+#include "cpu/join.hpp"
 
-void selfjoin(const double *__restrict _T, double *__restrict _P, size_t n, size_t m)
+namespace {
+
+// Single-precision inputs are shifted by a common offset (the mean of all values) before the
+// kernels run. Both distances are invariant to such a shift, and it keeps the cancellation
+// between the dot products and the mean or squared sum terms small. Double-precision inputs are
+// used as is.
+template <typename Scalar>
+double center_offset(const Scalar *T1, size_t n1, const Scalar *T2 = nullptr, size_t n2 = 0)
 {
-    size_t excl_zone = std::ceil(m / 4.0);
+    if (!std::is_same<Scalar, float>::value) {
+        return 0.0;
+    }
 
-    // Note: This is a workaround. icpx ignores __restrict on arugments in some situations.
-    const double *__restrict T = _T;
-    double *__restrict P = _P;
+    double sum = 0.0;
+    for (size_t i = 0; i < n1; i++) {
+        sum += T1[i];
+    }
+    for (size_t i = 0; i < n2; i++) {
+        sum += T2[i];
+    }
 
-    double *__restrict QT = new double[n - m + 1];
-    double *__restrict QT2 = new double[n - m + 1];
-    double *__restrict mu = new double[n - m + 1];
-    double *__restrict sigma_inv = new double[n - m + 1];
+    return sum / (n1 + n2);
+}
 
-    compute_mean_std(T, mu, sigma_inv, n, m);
+template <typename Scalar>
+const Scalar *center(const Scalar *T, size_t n, double offset, quickmp::host_vector<Scalar> &buffer)
+{
+    if (!std::is_same<Scalar, float>::value) {
+        return T;
+    }
 
-    for (size_t i = 0; i < n - m + 1; i++) {
-        sigma_inv[i] = 1.0 / sigma_inv[i];
+    buffer.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        buffer[i] = T[i] - offset;
     }
 
-    // TODO: Use sliding_dot_product_fft if m is large
-    sliding_dot_product_naive(T, T, QT, n, m);
+    return buffer.data();
+}
+
+// Low-memory version of selfjoin. Besides T and P, it only keeps the means and the inverse standard
+// deviations (in float), i.e. 1.5 (double) or 2 (float) arrays of length l:
+// - The first row of every tile is computed from scratch instead of taken from a dot product
+//   array, which costs O(m) per diagonal and needs neither QT nor the buffers of an FFT
+// - The standard deviations are computed into P, which is not used until the join
+// - Threads merge into P through small windows instead of partial profiles (see join_tiles)
+template <typename Scalar>
+void selfjoin_low_memory(const Scalar *T, Scalar *P, int64_t *I, size_t n, size_t m,
+                         size_t num_threads, Workspace<Scalar> &ws)
+{
+    size_t l = n - m + 1;
+    size_t excl_zone = std::ceil(m / 4.0);
+
+    ws.mu1.resize(l);
+    quickmp::host_vector<float> sigma_inv(l);
 
-    for (size_t j = 0; j < n - m + 1; j++) {
-        P[j] = (QT[j] - m * mu[0] * mu[j]) * sigma_inv[0] * sigma_inv[j];
+    Scalar *mu = ws.mu1.data();
+
+    T = center(T, n, center_offset(T, n), ws.Tc1);
+
+    compute_mean_std(T, mu, P, n, m);
+
+    for (size_t i = 0; i < l; i++) {
+        sigma_inv[i] = Scalar(1) / P[i];
     }
 
-    for (size_t j = 0; j < excl_zone + 1; j++) {
-        P[j] = 0.0;
+    std::fill(P, P + l, -INFINITY);
+    if (I) {
+        std::fill(I, I + l, -1);
     }
 
-    for (size_t j = excl_zone + 1; j < n - m + 1; j++) {
-        P[0] = std::max(P[0], P[j]);
+    ZNormalizedScore<Scalar, float> score{mu, sigma_inv.data(), mu, sigma_inv.data(), m};
+    join_diagonals<true, true>(score, T, T, static_cast<const Scalar *>(nullptr), P, I, P, I, l,
+                               l, m, excl_zone + 1, num_threads, &ws, true);
+
+    for (size_t i = 0; i < l; i++) {
+        P[i] = has_neighbor(i, l, excl_zone) ? score.distance(P[i]) : INFINITY;
     }
+}
+
+} // anonymous namespace
+
+template <typename Scalar>
+void selfjoin(const Scalar *T, Scalar *P, int64_t *I, size_t n, size_t m, size_t num_threads,
+              Workspace<Scalar> *workspace, bool low_memory)
+{
+    size_t l = n - m + 1;
+    size_t excl_zone = std::ceil(m / 4.0);
 
-    for (size_t i = 1; i < n - m + 1; i++) {
-        double max_pi = P[i];
+    // Use the workspace passed by the caller, or a temporary one
+    Workspace<Scalar> local;
+    Workspace<Scalar> &ws = workspace ? *workspace : local;
 
-        for (size_t j = i + excl_zone + 1; j < n - m + 1; j++) {
-            // Calculate sliding dot product
-            QT2[j] = QT[j - 1] - T[j - 1] * T[i - 1] + T[j + m - 1] * T[i + m - 1];
+    if (low_memory) {
+        selfjoin_low_memory(T, P, I, n, m, num_threads, ws);
+        return;
+    }
 
-            // Calculate distance profile
-            double dist = (QT2[j] - m * mu[i] * mu[j]) * sigma_inv[i] * sigma_inv[j];
+    ws.QT_row.resize(l);
+    ws.mu1.resize(l);
+    ws.sigma_inv1.resize(l);
 
-            // Update matrix profile
-            P[j] = std::max(P[j], dist);
+    Scalar *QT = ws.QT_row.data();
+    Scalar *mu = ws.mu1.data();
+    Scalar *sigma_inv = ws.sigma_inv1.data();
 
-            // Note: gcc/clang require -ffast-math to vectorize this reduction.
-            max_pi = std::max(max_pi, dist);
-        }
+    T = center(T, n, center_offset(T, n), ws.Tc1);
 
-        P[i] = max_pi;
+    compute_mean_std(T, mu, sigma_inv, n, m);
 
-        std::swap(QT, QT2);
+    for (size_t i = 0; i < l; i++) {
+        sigma_inv[i] = Scalar(1) / sigma_inv[i];
     }
 
-    for (size_t i = 0; i < n - m + 1; i++) {
-        P[i] = std::sqrt(2.0 * m * (1.0 - P[i] / m));
+    sliding_dot_product(T, T, QT, n, m, &ws.dot);
+
+    std::fill(P, P + l, -INFINITY);
+    if (I) {
+        std::fill(I, I + l, -1);
     }
 
-    delete[] QT;
-    delete[] QT2;
-    delete[] mu;
-    delete[] sigma_inv;
+    // The distance matrix is symmetric, so only the diagonals above the exclusion zone are
+    // traversed and each element updates both its row and its column
+    ZNormalizedScore<Scalar> score{mu, sigma_inv, mu, sigma_inv, m};
+    join_diagonals<true, true>(score, T, T, QT, P, I, P, I, l, l, m, excl_zone + 1, num_threads,
+                               &ws);
+
+    for (size_t i = 0; i < l; i++) {
+        P[i] = has_neighbor(i, l, excl_zone) ? score.distance(P[i]) : INFINITY;
+    }
 }
 
 // For each subsequence in T1, returns its nearest neighbor in T2
-void abjoin(const double *__restrict _T1, const double *__restrict _T2, double *__restrict _P,
-            size_t n1, size_t n2, size_t m)
+template <typename Scalar>
+void abjoin(const Scalar *T1, const Scalar *T2, Scalar *P, int64_t *I, size_t n1, size_t n2,
+            size_t m, size_t num_threads, Workspace<Scalar> *workspace)
 {
-    // Note: This is a workaround. icpx ignores __restrict on arugments in some situations.
-    const double *__restrict T1 = _T1;
-    const double *__restrict T2 = _T2;
-    double *__restrict P = _P;
-
-    double *__restrict QT = new double[n1 - m + 1];
-    double *__restrict QT2 = new double[n1 - m + 1];
-    double *__restrict mu1 = new double[n1 - m + 1];
-    double *__restrict mu2 = new double[n2 - m + 1];
-    double *__restrict sigma_inv1 = new double[n1 - m + 1];
-    double *__restrict sigma_inv2 = new double[n2 - m + 1];
+    size_t l1 = n1 - m + 1;
+    size_t l2 = n2 - m + 1;
+
+    // Use the workspace passed by the caller, or a temporary one
+    Workspace<Scalar> local;
+    Workspace<Scalar> &ws = workspace ? *workspace : local;
+    ws.QT_row.resize(l1);
+    ws.QT_col.resize(l2);
+    ws.mu1.resize(l1);
+    ws.sigma_inv1.resize(l1);
+    ws.mu2.resize(l2);
+    ws.sigma_inv2.resize(l2);
+
+    Scalar *mu1 = ws.mu1.data();
+    Scalar *sigma_inv1 = ws.sigma_inv1.data();
+    Scalar *mu2 = ws.mu2.data();
+    Scalar *sigma_inv2 = ws.sigma_inv2.data();
+
+    double offset = center_offset(T1, n1, T2, n2);
+    T1 = center(T1, n1, offset, ws.Tc1);
+    T2 = center(T2, n2, offset, ws.Tc2);
 
     compute_mean_std(T1, mu1, sigma_inv1, n1, m);
     compute_mean_std(T2, mu2, sigma_inv2, n2, m);
 
-    for (size_t i = 0; i < n1 - m + 1; i++) {
-        sigma_inv1[i] = 1.0 / sigma_inv1[i];
+    for (size_t i = 0; i < l1; i++) {
+        sigma_inv1[i] = Scalar(1) / sigma_inv1[i];
     }
 
-    for (size_t i = 0; i < n2 - m + 1; i++) {
-        sigma_inv2[i] = 1.0 / sigma_inv2[i];
+    for (size_t i = 0; i < l2; i++) {
+        sigma_inv2[i] = Scalar(1) / sigma_inv2[i];
     }
 
-    // TODO: Use sliding_dot_product_fft if m is large
-    sliding_dot_product_naive(T1, T2, QT, n1, m);
+    sliding_dot_product(T1, T2, ws.QT_row.data(), n1, m, &ws.dot);
+    sliding_dot_product(T2, T1, ws.QT_col.data(), n2, m, &ws.dot);
 
-    for (size_t j = 0; j < n1 - m + 1; j++) {
-        P[j] = (QT[j] - m * mu1[j] * mu2[0]) * sigma_inv1[j] * sigma_inv2[0];
+    std::fill(P, P + l1, -INFINITY);
+    if (I) {
+        std::fill(I, I + l1, -1);
     }
 
-    for (size_t i = 1; i < n2 - m + 1; i++) {
-        // Compute leftmost element
-        sliding_dot_product_naive(T1, T2 + i, QT2, m, m);
-        P[0] = std::max(P[0], (QT2[0] - m * mu1[0] * mu2[i]) * sigma_inv1[0] * sigma_inv2[i]);
+    // Diagonals on and above the main diagonal: rows are subsequences of T2, columns of T1
+    ZNormalizedScore<Scalar> score21{mu2, sigma_inv2, mu1, sigma_inv1, m};
+    join_diagonals<false, true>(score21, T2, T1, ws.QT_row.data(),
+                                static_cast<Scalar *>(nullptr), nullptr, P, I, l2, l1, m, 0,
+                                num_threads, &ws);
 
-        for (size_t j = 1; j < n1 - m + 1; j++) {
-            // Calculate sliding dot product
-            QT2[j] = QT[j - 1] - T1[j - 1] * T2[i - 1] + T1[j + m - 1] * T2[i + m - 1];
+    // Diagonals below the main diagonal, traversed on the transposed matrix
+    ZNormalizedScore<Scalar> score12{mu1, sigma_inv1, mu2, sigma_inv2, m};
+    join_diagonals<true, false>(score12, T1, T2, ws.QT_col.data(), P, I,
+                                static_cast<Scalar *>(nullptr), nullptr, l1, l2, m, 1,
+                                num_threads, &ws);
 
-            // Calculate distance profile
-            double dist = (QT2[j] - m * mu1[j] * mu2[i]) * sigma_inv1[j] * sigma_inv2[i];
-
-            // Update matrix profile
-            P[j] = std::max(P[j], dist);
-        }
-
-        std::swap(QT, QT2);
-    }
-
-    for (size_t i = 0; i < n1 - m + 1; i++) {
-        P[i] = std::sqrt(2.0 * m * (1.0 - P[i] / m));
+    for (size_t i = 0; i < l1; i++) {
+        P[i] = score12.distance(P[i]);
     }
-
-    delete[] QT;
-    delete[] QT2;
-    delete[] mu1;
-    delete[] mu2;
-    delete[] sigma_inv1;
-    delete[] sigma_inv2;
 }
 
 // Non-normalized Euclidean distance version of selfjoin
-void selfjoin_ed(const double *__restrict _T, double *__restrict _P, size_t n, size_t m)
+// In low-memory mode, the squared sums stay in full precision since the score subtracts them
+// from the dot products, but the dot product array and partial profiles are skipped as in
+// selfjoin.
+template <typename Scalar>
+void selfjoin_ed(const Scalar *T, Scalar *P, int64_t *I, size_t n, size_t m, size_t num_threads,
+                 Workspace<Scalar> *workspace, bool low_memory)
 {
+    size_t l = n - m + 1;
     size_t excl_zone = std::ceil(m / 4.0);
 
-    const double *__restrict T = _T;
-    double *__restrict P = _P;
-
-    double *__restrict QT = new double[n - m + 1];
-    double *__restrict QT2 = new double[n - m + 1];
-    double *__restrict S = new double[n - m + 1];
+    // Use the workspace passed by the caller, or a temporary one
+    Workspace<Scalar> local;
+    Workspace<Scalar> &ws = workspace ? *workspace : local;
+    ws.S1.resize(l);
 
-    compute_squared_sum(T, S, n, m);
+    Scalar *QT = nullptr;
+    Scalar *S = ws.S1.data();
 
-    // TODO: Use sliding_dot_product_fft if m is large
-    sliding_dot_product_naive(T, T, QT, n, m);
+    T = center(T, n, center_offset(T, n), ws.Tc1);
 
-    // Initialize distance profile (squared distance)
-    for (size_t j = 0; j < n - m + 1; j++) {
-        P[j] = S[0] + S[j] - 2.0 * QT[j];
-    }
+    compute_squared_sum(T, S, n, m);
 
-    // Set exclusion zone to infinity (minimization problem)
-    for (size_t j = 0; j < excl_zone + 1; j++) {
-        P[j] = INFINITY;
+    if (!low_memory) {
+        ws.QT_row.resize(l);
+        QT = ws.QT_row.data();
+        sliding_dot_product(T, T, QT, n, m, &ws.dot);
     }
 
-    // Find minimum for first row
-    for (size_t j = excl_zone + 1; j < n - m + 1; j++) {
-        P[0] = std::min(P[0], P[j]);
+    std::fill(P, P + l, -INFINITY);
+    if (I) {
+        std::fill(I, I + l, -1);
     }
 
-    // STOMP main loop (track minimum)
-    for (size_t i = 1; i < n - m + 1; i++) {
-        double min_pi = P[i];
-
-        for (size_t j = i + excl_zone + 1; j < n - m + 1; j++) {
-            // Calculate sliding dot product
-            QT2[j] = QT[j - 1] - T[j - 1] * T[i - 1] + T[j + m - 1] * T[i + m - 1];
-
-            // Squared Euclidean distance
-            double dist_sq = S[i] + S[j] - 2.0 * QT2[j];
+    EuclideanScore<Scalar> score{S, S};
+    join_diagonals<true, true>(score, T, T, QT, P, I, P, I, l, l, m, excl_zone + 1, num_threads,
+                               &ws, low_memory);
 
-            // Update matrix profile (minimum)
-            P[j] = std::min(P[j], dist_sq);
-            min_pi = std::min(min_pi, dist_sq);
-        }
-
-        P[i] = min_pi;
-
-        std::swap(QT, QT2);
+    for (size_t i = 0; i < l; i++) {
+        P[i] = has_neighbor(i, l, excl_zone) ? score.distance(P[i]) : INFINITY;
     }
-
-    // Convert squared distance to distance
-    for (size_t i = 0; i < n - m + 1; i++) {
-        P[i] = std::sqrt(P[i]);
-    }
-
-    delete[] QT;
-    delete[] QT2;
-    delete[] S;
 }
 
 // Non-normalized Euclidean distance version of abjoin
 // For each subsequence in T1, returns its nearest neighbor in T2
-void abjoin_ed(const double *__restrict _T1, const double *__restrict _T2, double *__restrict _P,
-               size_t n1, size_t n2, size_t m)
+template <typename Scalar>
+void abjoin_ed(const Scalar *T1, const Scalar *T2, Scalar *P, int64_t *I, size_t n1, size_t n2,
+               size_t m, size_t num_threads, Workspace<Scalar> *workspace)
 {
-    const double *__restrict T1 = _T1;
-    const double *__restrict T2 = _T2;
-    double *__restrict P = _P;
-
-    double *__restrict QT = new double[n1 - m + 1];
-    double *__restrict QT2 = new double[n1 - m + 1];
-    double *__restrict S1 = new double[n1 - m + 1];
-    double *__restrict S2 = new double[n2 - m + 1];
-
-    compute_squared_sum(T1, S1, n1, m);
-    compute_squared_sum(T2, S2, n2, m);
-
-    // TODO: Use sliding_dot_product_fft if m is large
-    sliding_dot_product_naive(T1, T2, QT, n1, m);
-
-    // Initialize distance profile (squared distance)
-    for (size_t j = 0; j < n1 - m + 1; j++) {
-        P[j] = S1[j] + S2[0] - 2.0 * QT[j];
+    size_t l1 = n1 - m + 1;
+    size_t l2 = n2 - m + 1;
+
+    // Use the workspace passed by the caller, or a temporary one
+    Workspace<Scalar> local;
+    Workspace<Scalar> &ws = workspace ? *workspace : local;
+    ws.QT_row.resize(l1);
+    ws.QT_col.resize(l2);
+    ws.S1.resize(l1);
+    ws.S2.resize(l2);
+
+    double offset = center_offset(T1, n1, T2, n2);
+    T1 = center(T1, n1, offset, ws.Tc1);
+    T2 = center(T2, n2, offset, ws.Tc2);
+
+    compute_squared_sum(T1, ws.S1.data(), n1, m);
+    compute_squared_sum(T2, ws.S2.data(), n2, m);
+
+    sliding_dot_product(T1, T2, ws.QT_row.data(), n1, m, &ws.dot);
+    sliding_dot_product(T2, T1, ws.QT_col.data(), n2, m, &ws.dot);
+
+    std::fill(P, P + l1, -INFINITY);
+    if (I) {
+        std::fill(I, I + l1, -1);
     }
 
-    for (size_t i = 1; i < n2 - m + 1; i++) {
-        // Compute leftmost element
-        sliding_dot_product_naive(T1, T2 + i, QT2, m, m);
-        double dist_sq = S1[0] + S2[i] - 2.0 * QT2[0];
-        P[0] = std::min(P[0], dist_sq);
+    EuclideanScore<Scalar> score21{ws.S2.data(), ws.S1.data()};
+    join_diagonals<false, true>(score21, T2, T1, ws.QT_row.data(),
+                                static_cast<Scalar *>(nullptr), nullptr, P, I, l2, l1, m, 0,
+                                num_threads, &ws);
 
-        for (size_t j = 1; j < n1 - m + 1; j++) {
-            // Calculate sliding dot product
-            QT2[j] = QT[j - 1] - T1[j - 1] * T2[i - 1] + T1[j + m - 1] * T2[i + m - 1];
+    EuclideanScore<Scalar> score12{ws.S1.data(), ws.S2.data()};
+    join_diagonals<true, false>(score12, T1, T2, ws.QT_col.data(), P, I,
+                                static_cast<Scalar *>(nullptr), nullptr, l1, l2, m, 1,
+                                num_threads, &ws);
 
-            // Squared Euclidean distance
-            dist_sq = S1[j] + S2[i] - 2.0 * QT2[j];
+    for (size_t i = 0; i < l1; i++) {
+        P[i] = score12.distance(P[i]);
+    }
+}
 
-            // Update matrix profile (minimum)
-            P[j] = std::min(P[j], dist_sq);
-        }
+template <typename Scalar>
+void prepare_selfjoin(Workspace<Scalar> &workspace, size_t n, size_t m, bool normalize,
+                      size_t num_threads)
+{
+    size_t l = n - m + 1;
+    size_t excl_zone = std::ceil(m / 4.0);
 
-        std::swap(QT, QT2);
+    workspace.QT_row.reserve(l);
+    if (normalize) {
+        workspace.mu1.reserve(l);
+        workspace.sigma_inv1.reserve(l);
+    } else {
+        workspace.S1.reserve(l);
     }
-
-    // Convert squared distance to distance
-    for (size_t i = 0; i < n1 - m + 1; i++) {
-        P[i] = std::sqrt(P[i]);
+    if (std::is_same<Scalar, float>::value) {
+        workspace.Tc1.reserve(n);
     }
 
-    delete[] QT;
-    delete[] QT2;
-    delete[] S1;
-    delete[] S2;
+    partition_diagonals(l, l, excl_zone + 1, tile_count(num_threads), workspace.tiles);
+    workspace.qt.reserve(TILE_WIDTH);
+    workspace.acc.reserve(TILE_WIDTH);
+
+    prepare_sliding_dot_product(workspace.dot, n, m, std::is_same<Scalar, float>::value);
 }
+
+template void selfjoin(const float *T, float *P, int64_t *I, size_t n, size_t m,
+                       size_t num_threads, Workspace<float> *workspace, bool low_memory);
+template void selfjoin(const double *T, double *P, int64_t *I, size_t n, size_t m,
+                       size_t num_threads, Workspace<double> *workspace, bool low_memory);
+template void abjoin(const float *T1, const float *T2, float *P, int64_t *I, size_t n1,
+                     size_t n2, size_t m, size_t num_threads, Workspace<float> *workspace);
+template void abjoin(const double *T1, const double *T2, double *P, int64_t *I, size_t n1,
+                     size_t n2, size_t m, size_t num_threads, Workspace<double> *workspace);
+template void selfjoin_ed(const float *T, float *P, int64_t *I, size_t n, size_t m,
+                          size_t num_threads, Workspace<float> *workspace, bool low_memory);
+template void selfjoin_ed(const double *T, double *P, int64_t *I, size_t n, size_t m,
+                          size_t num_threads, Workspace<double> *workspace, bool low_memory);
+template void abjoin_ed(const float *T1, const float *T2, float *P, int64_t *I, size_t n1,
+                        size_t n2, size_t m, size_t num_threads, Workspace<float> *workspace);
+template void abjoin_ed(const double *T1, const double *T2, double *P, int64_t *I, size_t n1,
+                        size_t n2, size_t m, size_t num_threads, Workspace<double> *workspace);
+template void prepare_selfjoin(Workspace<float> &workspace, size_t n, size_t m, bool normalize,
+                               size_t num_threads);
+template void prepare_selfjoin(Workspace<double> &workspace, size_t n, size_t m, bool normalize,
+                               size_t num_threads);
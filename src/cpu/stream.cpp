@@ -0,0 +1,285 @@
+#include "quickmp.hpp"
+#include "cpu/affinity.hpp"
+#include "cpu/device.hpp"
+#include "cpu/stream.hpp"
+
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace {
+
+std::mutex g_streams_mutex;
+// By device and stream number
+std::map<std::pair<int, int>, std::shared_ptr<Stream>> g_streams;
+
+} // anonymous namespace
+
+Stream::Stream(int device, size_t slot)
+    : worker_([this, device, slot] { worker_loop(device, slot); }) {}
+
+Stream::~Stream()
+{
+    shutdown();
+}
+
+uint64_t Stream::submit(std::function<void()> op)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t seq = ++submitted_;
+
+    if (!stop_) {
+        queue_.push_back(std::move(op));
+        work_cv_.notify_one();
+        return seq;
+    }
+
+    // Stopped by finalize(): run in order after the operations before it, which are complete
+    lock.unlock();
+    std::exception_ptr error;
+    try {
+        op();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    lock.lock();
+
+    finish_op(lock, error);
+    return seq;
+}
+
+uint64_t Stream::submitted()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return submitted_;
+}
+
+bool Stream::complete(uint64_t seq)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return completed_ >= seq;
+}
+
+void Stream::wait(uint64_t seq, bool clear_error)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [&] { return completed_ >= seq; });
+
+    if (error_ && error_seq_ <= seq) {
+        std::exception_ptr error = error_;
+        if (clear_error) {
+            error_ = nullptr;
+        }
+        std::rethrow_exception(error);
+    }
+}
+
+void Stream::on_complete(uint64_t seq, std::function<void()> callback)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (completed_ < seq) {
+            callbacks_.emplace(seq, std::move(callback));
+            return;
+        }
+    }
+
+    callback();
+}
+
+void Stream::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stop_) {
+            return;
+        }
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+
+    worker_.join();
+}
+
+void Stream::worker_loop(int device, size_t slot)
+{
+    // Operations that split their work across threads use the cores of this device
+    set_current_device(device);
+
+    uint64_t affinity_epoch = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+        work_cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+
+        if (queue_.empty()) {
+            return;
+        }
+
+        std::function<void()> op = std::move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+
+        pin_worker(slot, affinity_epoch);
+
+        std::exception_ptr error;
+        try {
+            op();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        // Destroy the operation before it is reported complete, so that the buffers it holds are
+        // released by then
+        op = nullptr;
+
+        lock.lock();
+
+        finish_op(lock, error);
+    }
+}
+
+void Stream::finish_op(std::unique_lock<std::mutex> &lock, std::exception_ptr error)
+{
+    completed_++;
+    if (error && !error_) {
+        error_ = error;
+        error_seq_ = completed_;
+    }
+    done_cv_.notify_all();
+
+    if (callbacks_.empty() || callbacks_.begin()->first > completed_) {
+        return;
+    }
+
+    std::vector<std::function<void()>> ready;
+    auto end = callbacks_.upper_bound(completed_);
+    for (auto it = callbacks_.begin(); it != end; ++it) {
+        ready.push_back(std::move(it->second));
+    }
+    callbacks_.erase(callbacks_.begin(), end);
+
+    lock.unlock();
+    for (auto &callback : ready) {
+        callback();
+    }
+    // Release what the callbacks hold before the stream moves on
+    ready.clear();
+    lock.lock();
+}
+
+std::shared_ptr<Stream> get_stream(int stream)
+{
+    if (stream < 0 || stream >= quickmp::get_stream_count()) {
+        throw std::runtime_error("Stream number must be in [0, get_stream_count()).");
+    }
+
+    int device = current_device();
+
+    std::lock_guard<std::mutex> lock(g_streams_mutex);
+    std::shared_ptr<Stream> &s = g_streams[{device, stream}];
+    if (!s) {
+        // Streams are spread over the cores of the device. The core of stream 0 is left to the
+        // caller of parallel_for by the device pool, and other streams move there while they
+        // call it (see ThreadPool::parallel_for).
+        s = std::make_shared<Stream>(device, device_first_core(device) + stream);
+    }
+    return s;
+}
+
+void wait_for_stream(int stream)
+{
+    std::shared_ptr<Stream> s;
+    {
+        std::lock_guard<std::mutex> lock(g_streams_mutex);
+        auto it = g_streams.find({current_device(), stream});
+        if (it == g_streams.end()) {
+            return;
+        }
+        s = it->second;
+    }
+
+    if (s) {
+        // Failures are reported by stream_synchronize, not by unrelated synchronous calls
+        try {
+            s->wait(s->submitted());
+        } catch (...) {
+        }
+    }
+}
+
+void shutdown_streams()
+{
+    std::map<std::pair<int, int>, std::shared_ptr<Stream>> streams;
+    {
+        std::lock_guard<std::mutex> lock(g_streams_mutex);
+        streams.swap(g_streams);
+    }
+
+    // Events keep their streams alive, so they can still be queried afterwards
+    for (auto &entry : streams) {
+        entry.second->shutdown();
+    }
+}
+
+namespace quickmp {
+
+struct Event::Impl {
+    std::shared_ptr<Stream> stream;
+    uint64_t seq = 0;
+};
+
+Event::Event() : impl_(new Impl()) {}
+
+Event::~Event() = default;
+
+Event::Event(Event &&) noexcept = default;
+
+Event &Event::operator=(Event &&) noexcept = default;
+
+void Event::record(int stream) {
+    std::shared_ptr<Stream> s = get_stream(stream);
+    impl_->seq = s->submitted();
+    impl_->stream = std::move(s);
+}
+
+bool Event::query() const {
+    return !impl_->stream || impl_->stream->complete(impl_->seq);
+}
+
+void Event::synchronize() const {
+    if (impl_->stream) {
+        impl_->stream->wait(impl_->seq);
+    }
+}
+
+void Event::add_callback(std::function<void()> callback) const {
+    if (impl_->stream) {
+        impl_->stream->on_complete(impl_->seq, std::move(callback));
+    } else {
+        callback();
+    }
+}
+
+void stream_synchronize(int stream) {
+    std::shared_ptr<Stream> s = get_stream(stream);
+    s->wait(s->submitted(), true);
+}
+
+void stream_wait_event(int stream, const Event &event) {
+    std::shared_ptr<Stream> s = get_stream(stream);
+    std::shared_ptr<Stream> other = event.impl_->stream;
+    uint64_t seq = event.impl_->seq;
+
+    if (other && other != s) {
+        // Failures of the other stream are reported by its own synchronization
+        s->submit([other, seq] {
+            try {
+                other->wait(seq);
+            } catch (...) {
+            }
+        });
+    }
+}
+
+} // namespace quickmp
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// In-order queue of operations run by a dedicated worker thread, backing a stream of the CPU
+// backend. Operations are numbered from 1 in submission order; an operation is complete once the
+// number of completed operations has reached its number.
+class Stream {
+public:
+    // Operations run on device (see cpu/device.hpp) by a worker in affinity slot slot (see
+    // cpu/affinity.hpp)
+    explicit Stream(int device = 0, size_t slot = 0);
+    ~Stream();
+
+    Stream(const Stream &) = delete;
+    Stream &operator=(const Stream &) = delete;
+
+    // Queue op and return its number
+    uint64_t submit(std::function<void()> op);
+
+    // Number of the last operation submitted so far
+    uint64_t submitted();
+
+    // True if operation seq is complete
+    bool complete(uint64_t seq);
+
+    // Wait until operation seq is complete, then rethrow the exception of the first operation
+    // up to seq that failed, if any. If clear_error, the exception is only thrown once.
+    void wait(uint64_t seq, bool clear_error = false);
+
+    // Run callback once operation seq is complete: by the worker thread right after it, or by
+    // the caller if it already is. callback must not throw.
+    void on_complete(uint64_t seq, std::function<void()> callback);
+
+    // Finish the queued operations and stop the worker thread. Operations submitted afterwards
+    // are run by the caller of submit().
+    void shutdown();
+
+private:
+    void worker_loop(int device, size_t slot);
+    // Mark the next operation complete and run the callbacks it releases. Called with lock held,
+    // which is released while the callbacks run.
+    void finish_op(std::unique_lock<std::mutex> &lock, std::exception_ptr error);
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    std::deque<std::function<void()>> queue_;
+    uint64_t submitted_ = 0;
+    uint64_t completed_ = 0;
+    // First failure since the last wait with clear_error, and the number of the operation
+    std::exception_ptr error_;
+    uint64_t error_seq_ = 0;
+    // Callbacks waiting for operations that are not complete yet, by operation number
+    std::multimap<uint64_t, std::function<void()>> callbacks_;
+    bool stop_ = false;
+    std::thread worker_;
+};
+
+// Stream number stream of the device selected on the calling thread, whose worker is started on
+// first use. Throws if stream is not in [0, get_stream_count()).
+std::shared_ptr<Stream> get_stream(int stream);
+
+// Wait until the operations queued on stream of the current device so far are complete, so that a
+// synchronous call on the stream runs after them. Does nothing for streams that were never used
+// (or do not exist).
+void wait_for_stream(int stream);
+
+// Finish the operations of all streams and stop their workers. Called by finalize().
+void shutdown_streams();
@@ -0,0 +1,233 @@
+#include "quickmp.hpp"
+#include "cpu/internal.hpp"
+#include "cpu/join.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace quickmp {
+
+// The profile is kept both as scores (see cpu/join.hpp), which are compared on every update,
+// and as distances, which are only recomputed for the entries that improve.
+struct StreamingSelfJoin::Impl {
+    size_t m;
+    bool normalize;
+    size_t excl_zone;
+
+    std::vector<double> T;
+    // QT[j]: dot product between the last subsequence and subsequence j
+    std::vector<double> QT;
+    // Statistics of every subsequence (mu and sigma_inv if normalized, S otherwise)
+    std::vector<double> mu, sigma_inv, S;
+    std::vector<double> P_score, P;
+    std::vector<int64_t> I;
+
+    void reserve(size_t capacity) {
+        if (capacity < m) {
+            return;
+        }
+
+        size_t l = capacity - m + 1;
+
+        T.reserve(capacity);
+        QT.reserve(l);
+        if (normalize) {
+            mu.reserve(l);
+            sigma_inv.reserve(l);
+        } else {
+            S.reserve(l);
+        }
+        P_score.reserve(l);
+        P.reserve(l);
+        I.reserve(l);
+    }
+
+    double to_score(double dist) const {
+        return normalize ? m - dist * dist / 2 : -dist * dist;
+    }
+
+    void init() {
+        size_t n = T.size();
+        size_t l = n - m + 1;
+
+        P.resize(l);
+        I.resize(l);
+        QT.resize(l);
+
+        if (normalize) {
+            ::selfjoin(T.data(), P.data(), I.data(), n, m);
+
+            mu.resize(l);
+            sigma_inv.resize(l);
+            ::compute_mean_std(T.data(), mu.data(), sigma_inv.data(), n, m);
+            for (size_t i = 0; i < l; i++) {
+                sigma_inv[i] = 1.0 / sigma_inv[i];
+            }
+        } else {
+            ::selfjoin_ed(T.data(), P.data(), I.data(), n, m);
+
+            S.resize(l);
+            ::compute_squared_sum(T.data(), S.data(), n, m);
+        }
+
+        P_score.resize(l);
+        for (size_t i = 0; i < l; i++) {
+            P_score[i] = to_score(P[i]);
+        }
+
+        ::sliding_dot_product(T.data(), T.data() + l - 1, QT.data(), n, m);
+    }
+
+    void push(double value) {
+        T.push_back(value);
+
+        if (T.size() < m) {
+            return;
+        }
+
+        // Index of the new subsequence
+        size_t s = T.size() - m;
+        const double *Ts = T.data() + s;
+
+        if (normalize) {
+            double sum = 0.0;
+            for (size_t x = 0; x < m; x++) {
+                sum += Ts[x];
+            }
+            double mu_s = sum / m;
+
+            double var = 0.0;
+            for (size_t x = 0; x < m; x++) {
+                var += (Ts[x] - mu_s) * (Ts[x] - mu_s);
+            }
+
+            mu.push_back(mu_s);
+            sigma_inv.push_back(1.0 / std::sqrt(var / m));
+        } else {
+            double sum = 0.0;
+            for (size_t x = 0; x < m; x++) {
+                sum += Ts[x] * Ts[x];
+            }
+            S.push_back(sum);
+        }
+
+        // Advance the dot products from subsequence s - 1 to s along the diagonals. QT[j] is
+        // derived from QT[j - 1], so the loop runs backwards to update in place.
+        QT.push_back(0.0);
+        if (s > 0) {
+            double T_first = T[s - 1];
+            double T_last = T[s + m - 1];
+
+            for (size_t j = s; j >= 1; j--) {
+                QT[j] = QT[j - 1] - T[j - 1] * T_first + T[j + m - 1] * T_last;
+            }
+        }
+
+        double qt_0 = 0.0;
+        for (size_t x = 0; x < m; x++) {
+            qt_0 += T[x] * Ts[x];
+        }
+        QT[0] = qt_0;
+
+        P_score.push_back(-INFINITY);
+        P.push_back(INFINITY);
+        I.push_back(-1);
+
+        if (normalize) {
+            ZNormalizedScore<double> score{mu.data(), sigma_inv.data(), mu.data(),
+                                           sigma_inv.data(), m};
+            update(score, s);
+        } else {
+            EuclideanScore<double> score{S.data(), S.data()};
+            update(score, s);
+        }
+    }
+
+    // Join the new subsequence s with every subsequence outside its exclusion zone
+    template <class Score>
+    void update(const Score &score, size_t s) {
+        if (s <= excl_zone) {
+            return;
+        }
+
+        double max_s = -INFINITY;
+        int64_t arg_s = -1;
+
+        for (size_t j = 0; j < s - excl_zone; j++) {
+            double dist = score(QT[j], s, j);
+
+            if (dist > P_score[j]) {
+                P_score[j] = dist;
+                P[j] = score.distance(dist);
+                I[j] = s;
+            }
+
+            if (dist > max_s) {
+                max_s = dist;
+                arg_s = j;
+            }
+        }
+
+        P_score[s] = max_s;
+        P[s] = score.distance(max_s);
+        I[s] = arg_s;
+    }
+};
+
+StreamingSelfJoin::StreamingSelfJoin(const double *T, size_t n, size_t m, bool normalize,
+                                     size_t capacity)
+    : impl_(new Impl()) {
+    if (m == 0) {
+        throw std::runtime_error("m must be positive.");
+    }
+
+    impl_->m = m;
+    impl_->normalize = normalize;
+    impl_->excl_zone = std::ceil(m / 4.0);
+    impl_->reserve(std::max(capacity, n));
+    impl_->T.assign(T, T + n);
+
+    if (n >= m) {
+        impl_->init();
+    }
+}
+
+StreamingSelfJoin::~StreamingSelfJoin() = default;
+
+StreamingSelfJoin::StreamingSelfJoin(StreamingSelfJoin &&) noexcept = default;
+
+StreamingSelfJoin &StreamingSelfJoin::operator=(StreamingSelfJoin &&) noexcept = default;
+
+void StreamingSelfJoin::append(const double *values, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        impl_->push(values[i]);
+    }
+}
+
+size_t StreamingSelfJoin::size() const {
+    return impl_->T.size();
+}
+
+size_t StreamingSelfJoin::window_size() const {
+    return impl_->m;
+}
+
+size_t StreamingSelfJoin::profile_size() const {
+    return impl_->P.size();
+}
+
+const double *StreamingSelfJoin::data() const {
+    return impl_->T.data();
+}
+
+const double *StreamingSelfJoin::profile() const {
+    return impl_->P.data();
+}
+
+const int64_t *StreamingSelfJoin::index() const {
+    return impl_->I.data();
+}
+
+} // namespace quickmp
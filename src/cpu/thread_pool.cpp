@@ -0,0 +1,119 @@
+#include "quickmp.hpp"
+#include "cpu/thread_pool.hpp"
+#include "cpu/affinity.hpp"
+
+#include <optional>
+
+namespace {
+
+// Pool whose worker is the calling thread, if any
+thread_local const ThreadPool *t_pool = nullptr;
+
+} // anonymous namespace
+
+ThreadPool::ThreadPool(size_t num_workers, size_t first_slot) : first_slot_(first_slot)
+{
+    workers_.reserve(num_workers);
+    for (size_t i = 0; i < num_workers; i++) {
+        workers_.emplace_back([this, slot = first_slot + i] { worker_loop(slot); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    job_cv_.notify_all();
+
+    for (auto &worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallel_for(size_t num_jobs, const std::function<void(size_t)> &fn)
+{
+    if (num_jobs == 0) {
+        return;
+    }
+
+    Batch batch{&fn, num_jobs, nullptr};
+
+    // The caller takes the slot before the workers while it helps (see cpu/device.hpp)
+    std::optional<SlotGuard> slot;
+    if (t_pool != this && first_slot_ > 0) {
+        slot.emplace(first_slot_ - 1);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < num_jobs; i++) {
+        queue_.push_back({&batch, i});
+    }
+    job_cv_.notify_all();
+
+    // Help draining the queue instead of idling until the workers are done
+    while (batch.remaining > 0) {
+        if (!queue_.empty()) {
+            Job job = queue_.front();
+            queue_.pop_front();
+            run_job(job, lock);
+        } else {
+            done_cv_.wait(lock);
+        }
+    }
+
+    if (batch.error) {
+        std::rethrow_exception(batch.error);
+    }
+}
+
+void ThreadPool::worker_loop(size_t slot)
+{
+    t_pool = this;
+    uint64_t affinity_epoch = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+        job_cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+
+        if (stop_ && queue_.empty()) {
+            return;
+        }
+
+        pin_worker(slot, affinity_epoch);
+
+        Job job = queue_.front();
+        queue_.pop_front();
+        run_job(job, lock);
+    }
+}
+
+// Must be called with the lock held; the lock is released while the job runs
+void ThreadPool::run_job(Job job, std::unique_lock<std::mutex> &lock)
+{
+    lock.unlock();
+
+    std::exception_ptr error;
+    try {
+        (*job.batch->fn)(job.index);
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    lock.lock();
+
+    if (error && !job.batch->error) {
+        job.batch->error = error;
+    }
+    if (--job.batch->remaining == 0) {
+        done_cv_.notify_all();
+    }
+}
+
+ThreadPool &global_thread_pool()
+{
+    static ThreadPool pool(quickmp::get_cpu_topology().usable_cpus - 1);
+
+    return pool;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads used by the multithreaded CPU kernels
+class ThreadPool {
+public:
+    // Workers occupy the affinity slots first_slot, ..., first_slot + num_workers - 1 (see
+    // cpu/affinity.hpp)
+    explicit ThreadPool(size_t num_workers, size_t first_slot = 1);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Run fn(0), ..., fn(num_jobs - 1) and wait for all of them to finish. The calling thread
+    // executes queued jobs while it waits, so calling parallel_for from a job cannot deadlock.
+    // A pinned caller other than a worker moves to slot first_slot - 1 meanwhile, so that it
+    // does not share a CPU with a worker. The first exception thrown by a job is rethrown to the
+    // caller.
+    void parallel_for(size_t num_jobs, const std::function<void(size_t)> &fn);
+
+    size_t size() const { return workers_.size(); }
+
+private:
+    struct Batch {
+        const std::function<void(size_t)> *fn;
+        size_t remaining;
+        std::exception_ptr error;
+    };
+
+    struct Job {
+        Batch *batch;
+        size_t index;
+    };
+
+    void worker_loop(size_t slot);
+    void run_job(Job job, std::unique_lock<std::mutex> &lock);
+
+    std::mutex mutex_;
+    std::condition_variable job_cv_;
+    std::condition_variable done_cv_;
+    std::deque<Job> queue_;
+    std::vector<std::thread> workers_;
+    size_t first_slot_;
+    bool stop_ = false;
+};
+
+// Process-wide pool with one worker per usable CPU (see get_cpu_topology; the caller of
+// parallel_for is the extra one)
+ThreadPool &global_thread_pool();
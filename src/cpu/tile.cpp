@@ -0,0 +1,144 @@
+#include "quickmp.hpp"
+#include "cpu/device.hpp"
+#include "cpu/internal.hpp"
+#include "cpu/block.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+namespace {
+
+// Join diagonals [k_first, k_end) of blocks a and b, skipping the diagonals of the exclusion
+// zone, [excl_first, excl_end)
+template <class Score>
+void join_excluding(const Score &score, const Block &a, const Block &b, BlockProfile &pa,
+                    BlockProfile &pb, bool index, size_t m, size_t k_first, size_t k_end,
+                    size_t excl_first, size_t excl_end, size_t num_threads, Workspace<double> &ws)
+{
+    size_t before = std::min(k_end, excl_first);
+    size_t after = std::max(k_first, excl_end);
+
+    if (k_first < before) {
+        join_blocks<true, true>(score, a, b, &pa, &pb, index, m, k_first, before, num_threads, ws);
+    }
+    if (after < k_end) {
+        join_blocks<true, true>(score, a, b, &pa, &pb, index, m, after, k_end, num_threads, ws);
+    }
+}
+
+// Write the distances of the profile of subsequences [begin, begin + length) to P and their
+// indices, offset by offset, to I (if not null). Subsequences whose neighbors [offset, end) all
+// lie in the exclusion zone get an infinite distance and index -1. They are found from their
+// position rather than from the score, since comparisons with infinity may be optimized away
+// under -ffast-math.
+template <class Score>
+void write_profile(const Score &score, const BlockProfile &profile, size_t begin, size_t length,
+                   size_t offset, size_t end, size_t excl_zone, double *P, int64_t *I)
+{
+    for (size_t t = 0; t < length; t++) {
+        size_t i = begin + t;
+        bool found = offset + excl_zone < i || i + excl_zone + 1 < end;
+
+        P[t] = found ? score.distance(profile.P[t]) : INFINITY;
+        if (I) {
+            I[t] = found ? profile.I[t] + offset : -1;
+        }
+    }
+}
+
+// The tile is split by the main diagonal of the rectangle: diagonals j - i >= 0 are joined with
+// the rows as A, diagonals j - i < 0 on the transposed rectangle. Global diagonal d = (j + col)
+// - (i + row) is in the exclusion zone if |d| <= excl_zone, which removes a contiguous range of
+// diagonals from each half.
+template <class Score>
+void selfjoin_tile_impl(const double *T, size_t m, size_t row_begin, size_t row_end,
+                        size_t col_begin, size_t col_end, double *P_row, int64_t *I_row,
+                        double *P_col, int64_t *I_col, size_t num_threads)
+{
+    bool index = I_row || I_col;
+    bool normalize = std::is_same<Score, ZNormalizedScore<double>>::value;
+    int64_t excl_zone = std::ceil(m / 4.0);
+    int64_t delta = int64_t(col_begin) - int64_t(row_begin);
+
+    Block row, col;
+    row.load(T, row_begin, row_end - row_begin, m, normalize);
+    col.load(T, col_begin, col_end - col_begin, m, normalize);
+
+    BlockProfile prow, pcol;
+    prow.reset(row.length, index);
+    pcol.reset(col.length, index);
+
+    Workspace<double> ws;
+
+    // Exclusion zone in local diagonals, clamped to [0, length]
+    auto clamp = [](int64_t k, size_t length) {
+        return static_cast<size_t>(std::min<int64_t>(std::max<int64_t>(k, 0), length));
+    };
+
+    // Diagonals k = j - i >= 0, global diagonal delta + k
+    Score score_rc = block_score<Score>(row, col, m);
+    join_excluding(score_rc, row, col, prow, pcol, index, m, 0, col.length,
+                   clamp(-delta - excl_zone, col.length), clamp(-delta + excl_zone + 1, col.length),
+                   num_threads, ws);
+
+    // Diagonals k = i - j >= 1, global diagonal delta - k
+    Score score_cr = block_score<Score>(col, row, m);
+    join_excluding(score_cr, col, row, pcol, prow, index, m, 1, row.length,
+                   clamp(delta - excl_zone, row.length), clamp(delta + excl_zone + 1, row.length),
+                   num_threads, ws);
+
+    write_profile(score_rc, prow, row_begin, row.length, col_begin, col_end, excl_zone, P_row,
+                  I_row);
+    if (P_col) {
+        write_profile(score_rc, pcol, col_begin, col.length, row_begin, row_end, excl_zone, P_col,
+                      I_col);
+    }
+}
+
+} // anonymous namespace
+
+namespace quickmp {
+
+void selfjoin_tile(const double *T, size_t n, size_t m, size_t row_begin, size_t row_end,
+                   size_t col_begin, size_t col_end, double *P_row, int64_t *I_row,
+                   double *P_col, int64_t *I_col, bool normalize, int num_threads) {
+    if (m == 0 || n < m) {
+        throw std::runtime_error("Time series must be at least as long as the window size.");
+    }
+
+    size_t l = n - m + 1;
+    if (row_begin >= row_end || row_end > l || col_begin >= col_end || col_end > l) {
+        throw std::runtime_error("Tile must be a non-empty range of rows and columns of the "
+                                 "distance matrix.");
+    }
+
+    size_t threads = resolve_num_threads(num_threads);
+
+    if (normalize) {
+        selfjoin_tile_impl<ZNormalizedScore<double>>(T, m, row_begin, row_end, col_begin,
+                                                      col_end, P_row, I_row, P_col, I_col,
+                                                      threads);
+    } else {
+        selfjoin_tile_impl<EuclideanScore<double>>(T, m, row_begin, row_end, col_begin, col_end,
+                                                   P_row, I_row, P_col, I_col, threads);
+    }
+}
+
+void merge_profiles(double *P, int64_t *I, const double *P_other, const int64_t *I_other,
+                    size_t n) {
+    for (size_t t = 0; t < n; t++) {
+        // Ties go to the smaller index, so that the result does not depend on the merge order
+        if (P_other[t] < P[t] ||
+            (I && P_other[t] == P[t] && I_other[t] >= 0 && (I[t] < 0 || I_other[t] < I[t]))) {
+            P[t] = P_other[t];
+            if (I) {
+                I[t] = I_other[t];
+            }
+        }
+    }
+}
+
+} // namespace quickmp
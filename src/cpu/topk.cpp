@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <cstdint>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "cpu/internal.hpp"
+
+template <typename Scalar>
+size_t select_topk(const Scalar *P, const int64_t *I, size_t l, size_t k, size_t excl_zone,
+                   bool discords, int64_t *index, int64_t *neighbor, Scalar *distance)
+{
+    if (k == 0) {
+        return 0;
+    }
+
+    // Entries are ranked by distance (ascending for motifs, descending for discords), and ties
+    // by position
+    using Entry = std::pair<Scalar, int64_t>;
+    auto better = [discords](const Entry &a, const Entry &b) {
+        if (a.first != b.first) {
+            return discords ? a.first > b.first : a.first < b.first;
+        }
+        return a.second < b.second;
+    };
+
+    // Every accepted entry suppresses at most 2 * excl_zone + 1 positions around itself, plus as
+    // many around its neighbor for motifs. Walking the ranking, at most this many entries can be
+    // rejected before k are accepted, so the best candidates always suffice.
+    size_t zone = 2 * excl_zone + 1;
+    size_t bound = k * (discords ? zone + 1 : 2 * zone + 1);
+
+    // Bounded heap whose top is the worst of the best candidates seen so far
+    std::priority_queue<Entry, std::vector<Entry>, decltype(better)> heap(better);
+
+    for (size_t i = 0; i < l; i++) {
+        // Subsequences without a neighbor outside the exclusion zone are found by their index,
+        // since isfinite() may be optimized away under -ffast-math
+        if (I[i] < 0) {
+            continue;
+        }
+
+        Entry entry(P[i], i);
+        if (heap.size() < bound) {
+            heap.push(entry);
+        } else if (better(entry, heap.top())) {
+            heap.pop();
+            heap.push(entry);
+        }
+    }
+
+    std::vector<Entry> candidates;
+    candidates.reserve(heap.size());
+    while (!heap.empty()) {
+        candidates.push_back(heap.top());
+        heap.pop();
+    }
+    std::reverse(candidates.begin(), candidates.end());
+
+    std::vector<bool> suppressed(l, false);
+    auto suppress = [&](int64_t i) {
+        size_t begin = i > static_cast<int64_t>(excl_zone) ? i - excl_zone : 0;
+        size_t end = std::min(i + excl_zone + 1, l);
+        std::fill(suppressed.begin() + begin, suppressed.begin() + end, true);
+    };
+
+    size_t found = 0;
+
+    for (const Entry &entry : candidates) {
+        if (found == k) {
+            break;
+        }
+
+        int64_t i = entry.second;
+        if (suppressed[i]) {
+            continue;
+        }
+
+        index[found] = i;
+        neighbor[found] = I[i];
+        distance[found] = entry.first;
+        found++;
+
+        suppress(i);
+        if (!discords && I[i] >= 0) {
+            suppress(I[i]);
+        }
+    }
+
+    return found;
+}
+
+template size_t select_topk(const float *P, const int64_t *I, size_t l, size_t k,
+                            size_t excl_zone, bool discords, int64_t *index, int64_t *neighbor,
+                            float *distance);
+template size_t select_topk(const double *P, const int64_t *I, size_t l, size_t k,
+                            size_t excl_zone, bool discords, int64_t *index, int64_t *neighbor,
+                            double *distance);
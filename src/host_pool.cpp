@@ -0,0 +1,366 @@
+#include "host_pool.hpp"
+#include "quickmp.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+using quickmp::HOST_ALIGNMENT;
+
+// Every block starts with a header, followed by the payload
+struct BlockHeader {
+    unsigned size_class;
+    // NUMA node of the thread that allocated the block (-1 unless numa_local)
+    int node;
+    // Mapping the block lives in, if it was allocated with mmap (map_size is 0 otherwise)
+    void *base;
+    size_t map_size;
+};
+
+constexpr size_t HEADER_SIZE = HOST_ALIGNMENT;
+static_assert(sizeof(BlockHeader) <= HEADER_SIZE, "Header does not fit");
+
+// Blocks of at least this size are mapped directly if huge_pages or numa_local is set, so that
+// they can be backed by huge pages and bound to a node
+constexpr size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+
+// Class 0 holds blocks of up to 64 bytes. Above that, every power of two (2^k, 2^(k+1)] is split
+// into classes of 5, 6, 7 and 8 times 2^(k-2) bytes, up to 2^48 bytes.
+constexpr unsigned MIN_SHIFT = 6;
+constexpr unsigned MAX_SHIFT = 48;
+constexpr unsigned NUM_CLASSES = 1 + (MAX_SHIFT - MIN_SHIFT) * 4;
+
+// Limits of the caches. A thread keeps at most THREAD_CACHE_BLOCKS blocks per class and
+// THREAD_CACHE_BYTES bytes in total; the shared cache keeps at most SHARED_CACHE_BYTES bytes.
+// Blocks that fit into neither are freed.
+constexpr size_t THREAD_CACHE_BLOCKS = 4;
+constexpr size_t THREAD_CACHE_BYTES = size_t(64) << 20;
+constexpr size_t SHARED_CACHE_BYTES = size_t(256) << 20;
+
+unsigned size_class(size_t size)
+{
+    if (size <= (size_t(1) << MIN_SHIFT)) {
+        return 0;
+    }
+    if (size > (size_t(1) << MAX_SHIFT)) {
+        throw std::bad_alloc();
+    }
+
+    // 2^k < size <= 2^(k+1), and (size - 1) >> (k - 2) is in [4, 7]
+    unsigned k = 63 - __builtin_clzll(size - 1);
+    size_t step = (size - 1) >> (k - 2);
+
+    return 1 + (k - MIN_SHIFT) * 4 + (step - 4);
+}
+
+size_t class_size(unsigned c)
+{
+    if (c == 0) {
+        return size_t(1) << MIN_SHIFT;
+    }
+
+    unsigned k = MIN_SHIFT + (c - 1) / 4;
+    size_t step = 5 + (c - 1) % 4;
+
+    return step << (k - 2);
+}
+
+BlockHeader &header(void *p)
+{
+    return *reinterpret_cast<BlockHeader *>(static_cast<char *>(p) - HEADER_SIZE);
+}
+
+// Allocation policy set by configure_host_pool()
+std::atomic<bool> g_huge_pages(false);
+std::atomic<bool> g_numa_local(false);
+
+// NUMA node of the CPU the calling thread runs on
+int current_node()
+{
+#ifdef __linux__
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+        return node;
+    }
+#endif
+    return 0;
+}
+
+// Map size bytes aligned to a huge page boundary, backed by huge pages if huge and bound to node
+// if it is not negative. Returns null if the mapping fails (and on systems other than Linux).
+void *map_block(size_t size, bool huge, int node)
+{
+#ifdef __linux__
+    constexpr int MPOL_PREFERRED_MODE = 1;
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    void *base = MAP_FAILED;
+
+    // Pages reserved in hugetlbfs are used if available, and transparent huge pages otherwise
+    if (huge) {
+        base = mmap(nullptr, size, prot, flags | MAP_HUGETLB, -1, 0);
+    }
+    if (base == MAP_FAILED) {
+        // Over-allocate so that the block can start at a huge page boundary, which transparent
+        // huge pages require
+        size_t raw_size = size + HUGE_PAGE_SIZE;
+        char *raw = static_cast<char *>(mmap(nullptr, raw_size, prot, flags, -1, 0));
+        if (raw == MAP_FAILED) {
+            return nullptr;
+        }
+
+        uintptr_t addr = reinterpret_cast<uintptr_t>(raw);
+        char *aligned = raw + (HUGE_PAGE_SIZE - addr % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+        if (aligned > raw) {
+            munmap(raw, aligned - raw);
+        }
+        if (aligned + size < raw + raw_size) {
+            munmap(aligned + size, raw + raw_size - (aligned + size));
+        }
+        base = aligned;
+
+        if (huge) {
+            madvise(base, size, MADV_HUGEPAGE);
+        }
+    }
+
+    // Pages are placed on the node when they are first touched, whichever thread touches them
+    if (node >= 0 && node < 64) {
+        unsigned long mask = 1UL << node;
+        syscall(SYS_mbind, base, size, MPOL_PREFERRED_MODE, &mask, 65, 0);
+    }
+
+    return base;
+#else
+    (void)size;
+    (void)huge;
+    (void)node;
+    return nullptr;
+#endif
+}
+
+void *system_alloc(unsigned c, int node)
+{
+    size_t size = HEADER_SIZE + class_size(c);
+    bool huge = g_huge_pages.load(std::memory_order_relaxed);
+    bool numa_local = g_numa_local.load(std::memory_order_relaxed);
+
+    void *base = nullptr;
+    size_t map_size = 0;
+
+    if ((huge || numa_local) && class_size(c) >= HUGE_PAGE_SIZE) {
+        map_size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        base = map_block(map_size, huge, node);
+    }
+    if (!base) {
+        base = ::operator new(size, std::align_val_t(HOST_ALIGNMENT));
+        map_size = 0;
+    }
+
+    void *p = static_cast<char *>(base) + HEADER_SIZE;
+    header(p) = BlockHeader{c, node, base, map_size};
+    return p;
+}
+
+void system_free(void *p)
+{
+    BlockHeader h = header(p);
+
+#ifdef __linux__
+    if (h.map_size > 0) {
+        munmap(h.base, h.map_size);
+        return;
+    }
+#endif
+    ::operator delete(h.base, std::align_val_t(HOST_ALIGNMENT));
+}
+
+struct SharedCache {
+    std::mutex mutex;
+    std::vector<std::vector<void *>> blocks = std::vector<std::vector<void *>>(NUM_CLASSES);
+    size_t bytes = 0;
+};
+
+// Never destroyed, since threads may still return blocks while the process exits
+SharedCache &shared_cache()
+{
+    static SharedCache *cache = new SharedCache();
+    return *cache;
+}
+
+// Keep block p of class c in the shared cache if there is room, and free it otherwise. The caller
+// must hold the mutex.
+void shared_put(SharedCache &shared, void *p, unsigned c) noexcept
+{
+    if (shared.bytes + class_size(c) <= SHARED_CACHE_BYTES) {
+        try {
+            shared.blocks[c].push_back(p);
+            shared.bytes += class_size(c);
+            return;
+        } catch (const std::bad_alloc &) {
+        }
+    }
+
+    system_free(p);
+}
+
+// Incremented by trim_memory_pool(). Threads release their caches the next time they use the pool
+// after noticing a new value.
+std::atomic<uint64_t> g_trim_epoch(0);
+
+enum class CacheState { Uninitialized, Live, Destroyed };
+
+// Per-thread cache. It is trivially destructible so that it stays usable until the thread exits;
+// the guard below releases its blocks first and marks it destroyed, after which blocks freed by
+// the exiting thread go to the shared cache.
+struct ThreadCache {
+    void *blocks[NUM_CLASSES][THREAD_CACHE_BLOCKS];
+    size_t count[NUM_CLASSES];
+    size_t bytes;
+    uint64_t epoch;
+    CacheState state;
+
+    // Move all cached blocks to the shared cache
+    void release() noexcept
+    {
+        SharedCache &shared = shared_cache();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+
+        for (unsigned c = 0; c < NUM_CLASSES; c++) {
+            for (size_t i = 0; i < count[c]; i++) {
+                shared_put(shared, blocks[c][i], c);
+            }
+            count[c] = 0;
+        }
+        bytes = 0;
+    }
+};
+
+thread_local ThreadCache t_cache;
+
+struct ThreadCacheGuard {
+    ~ThreadCacheGuard()
+    {
+        t_cache.release();
+        t_cache.state = CacheState::Destroyed;
+    }
+};
+
+// The calling thread's cache, or null if the thread is exiting
+ThreadCache *thread_cache() noexcept
+{
+    ThreadCache &cache = t_cache;
+    uint64_t epoch = g_trim_epoch.load(std::memory_order_relaxed);
+
+    if (cache.state == CacheState::Live) {
+        if (cache.epoch != epoch) {
+            cache.release();
+            cache.epoch = epoch;
+        }
+        return &cache;
+    }
+    if (cache.state == CacheState::Destroyed) {
+        return nullptr;
+    }
+
+    static thread_local ThreadCacheGuard guard;
+    cache.state = CacheState::Live;
+    cache.epoch = epoch;
+    return &cache;
+}
+
+} // anonymous namespace
+
+namespace quickmp {
+
+void *host_alloc(size_t size) {
+    unsigned c = size_class(size);
+
+    ThreadCache *cache = thread_cache();
+    if (cache && cache->count[c] > 0) {
+        cache->bytes -= class_size(c);
+        return cache->blocks[c][--cache->count[c]];
+    }
+
+    // Blocks cached by other threads are only reused if they are on the same node
+    int node = g_numa_local.load(std::memory_order_relaxed) ? current_node() : -1;
+
+    {
+        SharedCache &shared = shared_cache();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        auto &blocks = shared.blocks[c];
+
+        for (size_t i = blocks.size(); i > 0; i--) {
+            void *p = blocks[i - 1];
+            if (node < 0 || header(p).node == node) {
+                blocks.erase(blocks.begin() + (i - 1));
+                shared.bytes -= class_size(c);
+                return p;
+            }
+        }
+    }
+
+    return system_alloc(c, node);
+}
+
+void host_free(void *p) noexcept {
+    if (!p) {
+        return;
+    }
+
+    unsigned c = header(p).size_class;
+    size_t size = class_size(c);
+
+    ThreadCache *cache = thread_cache();
+    if (cache && cache->count[c] < THREAD_CACHE_BLOCKS &&
+        cache->bytes + size <= THREAD_CACHE_BYTES) {
+        cache->blocks[c][cache->count[c]++] = p;
+        cache->bytes += size;
+        return;
+    }
+
+    SharedCache &shared = shared_cache();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    shared_put(shared, p, c);
+}
+
+void trim_memory_pool() {
+    g_trim_epoch.fetch_add(1, std::memory_order_relaxed);
+
+    // The calling thread's cache is released right away, those of other threads when they next
+    // use the pool
+    thread_cache();
+
+    SharedCache &shared = shared_cache();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+
+    for (auto &blocks : shared.blocks) {
+        for (void *p : blocks) {
+            system_free(p);
+        }
+        blocks.clear();
+        blocks.shrink_to_fit();
+    }
+    shared.bytes = 0;
+}
+
+void configure_host_pool(bool huge_pages, bool numa_local) {
+    // Blocks cached under the previous policy are dropped, so that the new one applies to all
+    // blocks allocated from now on
+    trim_memory_pool();
+
+    g_huge_pages.store(huge_pages, std::memory_order_relaxed);
+    g_numa_local.store(numa_local, std::memory_order_relaxed);
+}
+
+} // namespace quickmp
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <vector>
+
+namespace quickmp {
+
+// Pool of host memory shared by the CPU kernels, the bindings and the VE backend.
+//
+// Block sizes are rounded up to size classes with four steps per power of two, so at most 25% of
+// a block is unused. Freed blocks are kept in a cache of the freeing thread, which serves later
+// allocations of the same class without locking, and spill over into a shared cache protected by
+// a mutex. Cached blocks stay mapped, so reused buffers do not page-fault again. trim_memory_pool()
+// (see quickmp.hpp) returns the cached blocks to the system.
+
+// Alignment of every block
+constexpr size_t HOST_ALIGNMENT = 64;
+
+// Set the allocation policy of blocks of 2 MB or more (Linux only, ignored elsewhere):
+// huge_pages: back them with huge pages (reserved hugetlbfs pages if available, transparent huge
+//             pages otherwise)
+// numa_local: bind them to the NUMA node of the allocating thread, and only hand blocks cached by
+//             other threads to threads on the same node
+// Frees all cached blocks. Called by initialize().
+void configure_host_pool(bool huge_pages, bool numa_local);
+
+// Allocate at least size bytes. Throws std::bad_alloc on failure.
+void *host_alloc(size_t size);
+
+// Return a block allocated by host_alloc to the pool (p may be null). Blocks may be freed by any
+// thread.
+void host_free(void *p) noexcept;
+
+// Allocator for standard containers backed by the pool
+template <typename T>
+struct HostAllocator {
+    using value_type = T;
+
+    HostAllocator() = default;
+
+    template <typename U>
+    HostAllocator(const HostAllocator<U> &) {}
+
+    T *allocate(size_t n)
+    {
+        if (n > std::numeric_limits<size_t>::max() / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T *>(host_alloc(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t) noexcept { host_free(p); }
+
+    template <typename U>
+    bool operator==(const HostAllocator<U> &) const
+    {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const HostAllocator<U> &) const
+    {
+        return false;
+    }
+};
+
+template <typename T>
+using host_vector = std::vector<T, HostAllocator<T>>;
+
+} // namespace quickmp
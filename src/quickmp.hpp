@@ -2,52 +2,337 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace quickmp {
 
+// Options of initialize()
+struct InitOptions {
+    // Back host buffers of 2 MB or more with huge pages (Linux only)
+    bool huge_pages = false;
+    // Place host buffers of 2 MB or more on the NUMA node of the allocating thread (Linux only)
+    bool numa_local = false;
+    // CPU backend: number of virtual devices to split the cores into (ignored for VE)
+    int cpu_devices = 1;
+    // Backend, one of list_backends() (empty: QUICKMP_BACKEND or else the default backend)
+    std::string backend;
+    // CPU backend: pin the worker threads ("compact", "scatter" or "none"; ignored for VE)
+    std::string affinity;
+    // CPU backend: CPUs to pin the worker threads to in order, instead of a policy
+    std::vector<int> cpus;
+};
+
 // Initialize backend (initializes all available devices, selects device 0)
-void initialize();
+void initialize(const InitOptions &options = InitOptions());
 
 // Finalize backend
 void finalize();
 
-// Get number of available devices (VE: number of VE devices, CPU: always 1)
+// Names of the backends of this build ("cpu" and the supported "cpu-<isa>", or "ve")
+std::vector<std::string> list_backends();
+
+// Name of the backend selected by initialize()
+std::string get_backend();
+
+// Get number of available devices (VE: number of VE devices, CPU: InitOptions::cpu_devices)
 int get_device_count();
 
-// Switch to the specified device
+// Switch to the specified device on the calling thread
 void use_device(int device);
 
 // Get the currently selected device ID
 int get_current_device();
 
 // Compute sliding dot product between T and Q
-// stream: VE stream number (ignored for CPU)
+// stream: stream to run on (see selfjoin_async)
 void sliding_dot_product(const double *T, const double *Q, double *QT,
                          size_t n, size_t m, int stream = 0);
 
 // Compute mean and standard deviation of every subsequence
-// stream: VE stream number (ignored for CPU)
+// stream: stream to run on (see selfjoin_async)
 void compute_mean_std(const double *T, double *mu, double *sigma,
                       size_t n, size_t m, int stream = 0);
 
 // Self-join: compute matrix profile for a single time series
-// stream: VE stream number (ignored for CPU)
+// stream: stream to run on (see selfjoin_async)
 // normalize: if true, use Z-normalized Euclidean distance; otherwise use raw Euclidean distance
+// num_threads: number of CPU threads to split the computation across (0: all cores, ignored for VE)
+// low_memory: if true, use about 1.5 arrays of length n of scratch memory (CPU backend only)
 void selfjoin(const double *T, double *P, size_t n, size_t m, int stream = 0,
-              bool normalize = true);
+              bool normalize = true, int num_threads = 1, bool low_memory = false);
+
+// Self-join that also returns the matrix profile index
+// I: index of the nearest neighbor of each subsequence (-1 if there is none; CPU backend only)
+void selfjoin(const double *T, double *P, int64_t *I, size_t n, size_t m, int stream = 0,
+              bool normalize = true, int num_threads = 1, bool low_memory = false);
 
 // AB-join: compute matrix profile between two time series
-// stream: VE stream number (ignored for CPU)
+// stream: stream to run on (see selfjoin_async)
 // normalize: if true, use Z-normalized Euclidean distance; otherwise use raw Euclidean distance
 void abjoin(const double *T1, const double *T2, double *P,
             size_t n1, size_t n2, size_t m, int stream = 0, bool normalize = true);
 
+// AB-join that also returns the matrix profile index
+// I: index of the nearest neighbor in T2 of each subsequence in T1 (CPU backend only)
+void abjoin(const double *T1, const double *T2, double *P, int64_t *I,
+            size_t n1, size_t n2, size_t m, int stream = 0, bool normalize = true);
+
+// Single-precision versions of the functions above (CPU backend only)
+void sliding_dot_product(const float *T, const float *Q, float *QT,
+                         size_t n, size_t m, int stream = 0);
+void compute_mean_std(const float *T, float *mu, float *sigma,
+                      size_t n, size_t m, int stream = 0);
+void selfjoin(const float *T, float *P, size_t n, size_t m, int stream = 0,
+              bool normalize = true, int num_threads = 1, bool low_memory = false);
+void selfjoin(const float *T, float *P, int64_t *I, size_t n, size_t m, int stream = 0,
+              bool normalize = true, int num_threads = 1, bool low_memory = false);
+void abjoin(const float *T1, const float *T2, float *P,
+            size_t n1, size_t n2, size_t m, int stream = 0, bool normalize = true);
+void abjoin(const float *T1, const float *T2, float *P, int64_t *I,
+            size_t n1, size_t n2, size_t m, int stream = 0, bool normalize = true);
+
+// Asynchronous versions of the functions above, run in submission order on stream
+void sliding_dot_product_async(const double *T, const double *Q, double *QT, size_t n, size_t m,
+                               int stream = 0);
+void compute_mean_std_async(const double *T, double *mu, double *sigma, size_t n, size_t m,
+                            int stream = 0);
+// I: index of the nearest neighbor of each subsequence, or null
+void selfjoin_async(const double *T, double *P, int64_t *I, size_t n, size_t m, int stream = 0,
+                    bool normalize = true, int num_threads = 1);
+void abjoin_async(const double *T1, const double *T2, double *P, int64_t *I, size_t n1,
+                  size_t n2, size_t m, int stream = 0, bool normalize = true);
+
+void sliding_dot_product_async(const float *T, const float *Q, float *QT, size_t n, size_t m,
+                               int stream = 0);
+void compute_mean_std_async(const float *T, float *mu, float *sigma, size_t n, size_t m,
+                            int stream = 0);
+void selfjoin_async(const float *T, float *P, int64_t *I, size_t n, size_t m, int stream = 0,
+                    bool normalize = true, int num_threads = 1);
+void abjoin_async(const float *T1, const float *T2, float *P, int64_t *I, size_t n1, size_t n2,
+                  size_t m, int stream = 0, bool normalize = true);
+
+// Wait until the operations submitted to stream are complete and rethrow their first exception
+void stream_synchronize(int stream);
+
+// Marker in a stream, complete once the operations submitted before record() are
+class Event {
+public:
+    Event();
+    ~Event();
+
+    Event(Event &&) noexcept;
+    Event &operator=(Event &&) noexcept;
+
+    // Capture the operations submitted to stream so far, replacing those of an earlier record()
+    void record(int stream = 0);
+
+    // True if the captured operations are complete (or nothing has been recorded)
+    bool query() const;
+
+    // Wait until the captured operations are complete and rethrow their first exception
+    void synchronize() const;
+
+    // Run callback once the captured operations are complete (must not throw or wait on them)
+    void add_callback(std::function<void()> callback) const;
+
+private:
+    friend void stream_wait_event(int stream, const Event &event);
+
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// Make operations submitted to stream from now on wait until event is complete
+void stream_wait_event(int stream, const Event &event);
+
+// Batched self-join: compute the matrix profiles of num_series time series of any length
+// T[s], n[s]: time series s and its length
+// P[s]: matrix profile of time series s (length n[s] - m + 1)
+// I: null, or I[s] receives the matrix profile index of time series s (CPU backend only)
+// num_threads: number of CPU threads (0: all cores, ignored for VE)
+void selfjoin_batch(const double *const *T, double *const *P, int64_t *const *I, const size_t *n,
+                    size_t num_series, size_t m, bool normalize = true, int num_threads = 0);
+
+// Batched AB-join: P[s] receives the matrix profile between T1[s] and T2[s] (see selfjoin_batch)
+void abjoin_batch(const double *const *T1, const double *const *T2, double *const *P,
+                  int64_t *const *I, const size_t *n1, const size_t *n2, size_t num_series,
+                  size_t m, bool normalize = true, int num_threads = 0);
+
+// Single-precision versions of the batched joins (CPU backend only)
+void selfjoin_batch(const float *const *T, float *const *P, int64_t *const *I, const size_t *n,
+                    size_t num_series, size_t m, bool normalize = true, int num_threads = 0);
+void abjoin_batch(const float *const *T1, const float *const *T2, float *const *P,
+                  int64_t *const *I, const size_t *n1, const size_t *n2, size_t num_series,
+                  size_t m, bool normalize = true, int num_threads = 0);
+
+// Out-of-core self-join of a time series file within memory_budget bytes (CPU backend only)
+// input: 1-D float64 .npy file, or raw native-endian float64 values for any other extension
+// output: matrix profile file (.npy if the path ends with .npy, raw float64 otherwise)
+// output_index: matrix profile index file (int64, same convention), or null
+// num_threads: number of CPU threads to split each pair of blocks across (0: all cores)
+void selfjoin_file(const char *input, const char *output, const char *output_index, size_t m,
+                   bool normalize = true, int num_threads = 1,
+                   size_t memory_budget = size_t(1) << 30);
+
+// Out-of-core AB-join of the time series files input1 and input2 (see selfjoin_file)
+void abjoin_file(const char *input1, const char *input2, const char *output,
+                 const char *output_index, size_t m, bool normalize = true, int num_threads = 1,
+                 size_t memory_budget = size_t(1) << 30);
+
+// Partial self-join over tile [row_begin, row_end) x [col_begin, col_end) (CPU backend only)
+// P_row, I_row: profile of the rows among the columns of the tile (I_row may be null)
+// P_col, I_col: profile of the columns among the rows of the tile, or null
+void selfjoin_tile(const double *T, size_t n, size_t m, size_t row_begin, size_t row_end,
+                   size_t col_begin, size_t col_end, double *P_row, int64_t *I_row,
+                   double *P_col = nullptr, int64_t *I_col = nullptr, bool normalize = true,
+                   int num_threads = 1);
+
+// Merge partial profile (P_other, I_other) of length n into (P, I) (CPU backend only)
+void merge_profiles(double *P, int64_t *I, const double *P_other, const int64_t *I_other,
+                    size_t n);
+
+// Top-k motifs: the k subsequences with the smallest matrix profile values (CPU backend only)
+// index, neighbor, distance: arrays of length k receiving each motif, its neighbor and distance
+// Returns the number of motifs found, which may be less than k
+size_t topk_motifs(const double *T, size_t n, size_t m, size_t k, int64_t *index,
+                   int64_t *neighbor, double *distance, int stream = 0, bool normalize = true,
+                   int num_threads = 1);
+
+// Top-k discords: the k subsequences with the largest matrix profile values (see topk_motifs)
+size_t topk_discords(const double *T, size_t n, size_t m, size_t k, int64_t *index,
+                     int64_t *neighbor, double *distance, int stream = 0, bool normalize = true,
+                     int num_threads = 1);
+
+// Single-precision versions of the top-k functions
+size_t topk_motifs(const float *T, size_t n, size_t m, size_t k, int64_t *index,
+                   int64_t *neighbor, float *distance, int stream = 0, bool normalize = true,
+                   int num_threads = 1);
+size_t topk_discords(const float *T, size_t n, size_t m, size_t k, int64_t *index,
+                     int64_t *neighbor, float *distance, int stream = 0, bool normalize = true,
+                     int num_threads = 1);
+
+// Reusable self-join of time series of length n, set up once (CPU backend only, not thread-safe)
+// normalize: if true, use Z-normalized Euclidean distance; otherwise use raw Euclidean distance
+// num_threads: number of CPU threads to split each self-join across (0: all cores)
+class Plan {
+public:
+    Plan(size_t n, size_t m, bool normalize = true, int num_threads = 1);
+    ~Plan();
+
+    Plan(Plan &&) noexcept;
+    Plan &operator=(Plan &&) noexcept;
+
+    // Compute the matrix profile P of T (n points), and its index if I is not null
+    void execute(const double *T, double *P, int64_t *I = nullptr);
+
+    // Length of the time series
+    size_t size() const;
+    // Window size
+    size_t window_size() const;
+    // Length of the matrix profile
+    size_t profile_size() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// Incremental self-join of a growing time series (STAMPI, CPU backend only)
+// T: initial time series (may be empty, n < m is allowed)
+// normalize: if true, use Z-normalized Euclidean distance; otherwise use raw Euclidean distance
+// capacity: number of points to reserve storage for (0: grow as needed)
+class StreamingSelfJoin {
+public:
+    StreamingSelfJoin(const double *T, size_t n, size_t m, bool normalize = true,
+                      size_t capacity = 0);
+    ~StreamingSelfJoin();
+
+    StreamingSelfJoin(StreamingSelfJoin &&) noexcept;
+    StreamingSelfJoin &operator=(StreamingSelfJoin &&) noexcept;
+
+    // Append count points to the time series and update the matrix profile
+    void append(const double *values, size_t count);
+
+    // Number of points in the time series
+    size_t size() const;
+    // Window size
+    size_t window_size() const;
+    // Length of the matrix profile (0 while fewer than m points have been appended)
+    size_t profile_size() const;
+
+    // Time series, matrix profile and index (invalidated by append() beyond the capacity)
+    const double *data() const;
+    const double *profile() const;
+    const int64_t *index() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// Anytime self-join over a random order of diagonals (SCRIMP++, CPU backend only)
+// T: time series (copied)
+// normalize: if true, use Z-normalized Euclidean distance; otherwise use raw Euclidean distance
+// num_threads: number of CPU threads to split the computation across (0: all cores)
+// seed: seed of the random order
+// prescrimp: if true, run PreSCRIMP before the diagonals
+class AnytimeSelfJoin {
+public:
+    AnytimeSelfJoin(const double *T, size_t n, size_t m, bool normalize = true,
+                    int num_threads = 1, uint64_t seed = 0, bool prescrimp = true);
+    ~AnytimeSelfJoin();
+
+    AnytimeSelfJoin(AnytimeSelfJoin &&) noexcept;
+    AnytimeSelfJoin &operator=(AnytimeSelfJoin &&) noexcept;
+
+    // Continue for time_budget seconds or a further fraction of the diagonals; true once exact
+    bool run(double time_budget = std::numeric_limits<double>::infinity(),
+             double fraction = 1.0);
+
+    // Fraction of diagonals processed so far
+    double progress() const;
+    // True once all diagonals have been processed
+    bool done() const;
+
+    // Length of the matrix profile
+    size_t profile_size() const;
+    // Best-so-far matrix profile and index (inf and -1 for subsequences not yet joined)
+    const double *profile() const;
+    const int64_t *index() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// Free the host memory cached by the memory pool (also done by finalize())
+void trim_memory_pool();
+
 // Sleep for specified microseconds on VE (for benchmarking)
-// stream: VE stream number (ignored for CPU)
+// stream: stream to run on (see selfjoin_async)
 void sleep_us(uint64_t microseconds, int stream = 0);
 
+// CPUs available to the process (the CPU backend sizes its thread pool after usable_cpus)
+struct CpuTopology {
+    // Hardware threads of the host (std::thread::hardware_concurrency())
+    int hardware_threads;
+    // CPUs in the affinity mask of the process (Linux only, hardware_threads elsewhere)
+    int affinity_cpus;
+    // CPUs granted by the cgroup v1 or v2 CPU quota, or 0 if there is none (Linux only)
+    double cpu_quota;
+    // Minimum of the above, with the quota rounded up, and at least 1
+    int usable_cpus;
+};
+
+// Detect the CPU topology (once per process; does not require initialize())
+CpuTopology get_cpu_topology();
+
 // Get number of available streams for parallel execution
-// CPU backend: returns number of CPU cores
+// CPU backend: returns number of usable CPUs (see get_cpu_topology) of the current device
 // VE backend: returns number of VE streams for current context
 int get_stream_count();
 
@@ -0,0 +1,144 @@
+#include "quickmp.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+#ifdef __linux__
+bool is_directory(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// CPUs granted by the CFS quota set on the cgroup directory dir, or 0 if there is none
+double read_quota(const std::string &dir, bool v2) {
+    long long quota = -1, period = 0;
+
+    if (v2) {
+        // "max 100000" if unlimited, "<quota> <period>" otherwise
+        std::ifstream file(dir + "/cpu.max");
+        std::string value;
+        if (file >> value >> period && value != "max") {
+            quota = std::stoll(value);
+        }
+    } else {
+        std::ifstream quota_file(dir + "/cpu.cfs_quota_us");
+        std::ifstream period_file(dir + "/cpu.cfs_period_us");
+        quota_file >> quota;
+        period_file >> period;
+    }
+
+    return quota > 0 && period > 0 ? static_cast<double>(quota) / period : 0.0;
+}
+
+// Tightest quota of the cgroup at path under the hierarchy mounted at mount and its ancestors.
+// Inside a container without a cgroup namespace, path is not visible and the container's own
+// cgroup is mounted at mount itself.
+double hierarchy_quota(const std::string &mount, std::string path, bool v2) {
+    if (!is_directory(mount + path)) {
+        path = "/";
+    }
+
+    double quota = 0.0;
+    while (true) {
+        double q = read_quota(mount + path, v2);
+        if (q > 0.0 && (quota == 0.0 || q < quota)) {
+            quota = q;
+        }
+        if (path.empty() || path == "/") {
+            break;
+        }
+        path = path.substr(0, path.find_last_of('/'));
+    }
+    return quota;
+}
+
+// CPU quota of the cgroups of the process, v1 or v2, or 0 if there is none
+double cgroup_cpu_quota() {
+    std::ifstream file("/proc/self/cgroup");
+    std::string line;
+    double quota = 0.0;
+
+    // Lines are "<id>:<controllers>:<path>"; cgroup v2 has id 0 and no controllers
+    while (std::getline(file, line)) {
+        size_t first = line.find(':');
+        size_t second = line.find(':', first + 1);
+        if (first == std::string::npos || second == std::string::npos) {
+            continue;
+        }
+        std::string controllers = line.substr(first + 1, second - first - 1);
+        std::string path = line.substr(second + 1);
+
+        double q = 0.0;
+        if (controllers.empty()) {
+            q = hierarchy_quota("/sys/fs/cgroup", path, true);
+            if (q == 0.0) {
+                // Hybrid hierarchy
+                q = hierarchy_quota("/sys/fs/cgroup/unified", path, true);
+            }
+        } else {
+            std::stringstream list(controllers);
+            std::string controller;
+            while (std::getline(list, controller, ',')) {
+                if (controller == "cpu") {
+                    q = hierarchy_quota("/sys/fs/cgroup/" + controllers, path, false);
+                    if (q == 0.0) {
+                        q = hierarchy_quota("/sys/fs/cgroup/cpu", path, false);
+                    }
+                }
+            }
+        }
+
+        if (q > 0.0 && (quota == 0.0 || q < quota)) {
+            quota = q;
+        }
+    }
+    return quota;
+}
+#endif
+
+quickmp::CpuTopology detect_cpu_topology() {
+    quickmp::CpuTopology topology;
+
+    unsigned int threads = std::thread::hardware_concurrency();
+    topology.hardware_threads = threads > 0 ? static_cast<int>(threads) : 1;
+    topology.affinity_cpus = topology.hardware_threads;
+    topology.cpu_quota = 0.0;
+
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        topology.affinity_cpus = std::max(CPU_COUNT(&set), 1);
+    }
+    topology.cpu_quota = cgroup_cpu_quota();
+#endif
+
+    topology.usable_cpus = std::min(topology.hardware_threads, topology.affinity_cpus);
+    if (topology.cpu_quota > 0.0) {
+        // A quota of 1.5 CPUs keeps two threads busy for 75% of the time each
+        int quota = static_cast<int>(std::ceil(topology.cpu_quota));
+        topology.usable_cpus = std::max(std::min(topology.usable_cpus, quota), 1);
+    }
+    return topology;
+}
+
+} // anonymous namespace
+
+namespace quickmp {
+
+CpuTopology get_cpu_topology() {
+    static const CpuTopology topology = detect_cpu_topology();
+    return topology;
+}
+
+} // namespace quickmp
@@ -1,4 +1,5 @@
 #include "quickmp.hpp"
+#include "host_pool.hpp"
 
 #include <cstdio>
 #include <cstdlib>
@@ -92,6 +93,7 @@ struct DeviceContext {
     MemoryPool pool;
 };
 
+std::mutex g_devices_mutex;                             // Guards changes to g_devices
 std::vector<std::unique_ptr<DeviceContext>> g_devices;  // All device contexts
 thread_local int g_current_device = -1;                 // Currently selected device ID (per-thread)
 
@@ -107,11 +109,25 @@ DeviceContext& current_device() {
 
 namespace quickmp {
 
-void initialize() {
+void initialize(const InitOptions &options) {
+    std::lock_guard<std::mutex> lock(g_devices_mutex);
     if (!g_devices.empty()) {
         throw std::runtime_error("quickmp already initialized. Call finalize() first.");
     }
 
+    std::string backend = options.backend;
+    if (backend.empty()) {
+        const char *env = std::getenv("QUICKMP_BACKEND");
+        backend = env ? env : "ve";
+    }
+    if (backend != "ve") {
+        throw std::runtime_error("Unknown or unsupported backend: " + backend +
+                                 " (available: ve).");
+    }
+
+    // Only affects the host buffers
+    configure_host_pool(options.huge_pages, options.numa_local);
+
     VEDA_CHECK(vedaInit(0));
 
     // Get number of available devices
@@ -145,6 +161,8 @@ void initialize() {
 }
 
 void finalize() {
+    std::lock_guard<std::mutex> lock(g_devices_mutex);
+
     // Clear memory pools for all devices
     for (auto& dev : g_devices) {
         VEDA_CHECK(vedaCtxSetCurrent(dev->ctx));
@@ -155,13 +173,25 @@ void finalize() {
     g_current_device = -1;
 
     VEDA_CHECK(vedaExit());
+
+    trim_memory_pool();
+}
+
+std::vector<std::string> list_backends() {
+    return {"ve"};
+}
+
+std::string get_backend() {
+    return "ve";
 }
 
 int get_device_count() {
+    std::lock_guard<std::mutex> lock(g_devices_mutex);
     return static_cast<int>(g_devices.size());
 }
 
 void use_device(int device) {
+    std::lock_guard<std::mutex> lock(g_devices_mutex);
     if (device < 0 || device >= static_cast<int>(g_devices.size())) {
         throw std::runtime_error("Invalid device ID: " + std::to_string(device));
     }
@@ -231,7 +261,10 @@ void compute_mean_std(const double *T, double *mu, double *sigma,
     dev.pool.free(sigma_ptr);
 }
 
-void selfjoin(const double *T, double *P, size_t n, size_t m, int stream, bool normalize) {
+void selfjoin(const double *T, double *P, size_t n, size_t m, int stream, bool normalize,
+              int num_threads, bool low_memory) {
+    (void)num_threads;
+    (void)low_memory;
     DeviceContext& dev = current_device();
     VEDAstream veda_stream = static_cast<VEDAstream>(stream);
 
@@ -289,6 +322,262 @@ void abjoin(const double *T1, const double *T2, double *P,
     dev.pool.free(P_ptr);
 }
 
+void selfjoin(const double *, double *, int64_t *, size_t, size_t, int, bool, int, bool) {
+    throw std::runtime_error("Matrix profile index is not supported on the VE backend.");
+}
+
+void abjoin(const double *, const double *, double *, int64_t *, size_t, size_t, size_t, int,
+            bool) {
+    throw std::runtime_error("Matrix profile index is not supported on the VE backend.");
+}
+
+void sliding_dot_product(const float *, const float *, float *, size_t, size_t, int) {
+    throw std::runtime_error("Single precision is not supported on the VE backend.");
+}
+
+void compute_mean_std(const float *, float *, float *, size_t, size_t, int) {
+    throw std::runtime_error("Single precision is not supported on the VE backend.");
+}
+
+void selfjoin(const float *, float *, size_t, size_t, int, bool, int, bool) {
+    throw std::runtime_error("Single precision is not supported on the VE backend.");
+}
+
+void selfjoin(const float *, float *, int64_t *, size_t, size_t, int, bool, int, bool) {
+    throw std::runtime_error("Single precision is not supported on the VE backend.");
+}
+
+void abjoin(const float *, const float *, float *, size_t, size_t, size_t, int, bool) {
+    throw std::runtime_error("Single precision is not supported on the VE backend.");
+}
+
+void abjoin(const float *, const float *, float *, int64_t *, size_t, size_t, size_t, int, bool) {
+    throw std::runtime_error("Single precision is not supported on the VE backend.");
+}
+
+void selfjoin_batch(const double *const *T, double *const *P, int64_t *const *I, const size_t *n,
+                    size_t num_series, size_t m, bool normalize, int num_threads) {
+    (void)num_threads;
+    if (I) {
+        throw std::runtime_error("Matrix profile index is not supported on the VE backend.");
+    }
+    for (size_t s = 0; s < num_series; s++) {
+        selfjoin(T[s], P[s], n[s], m, 0, normalize);
+    }
+}
+
+void abjoin_batch(const double *const *T1, const double *const *T2, double *const *P,
+                  int64_t *const *I, const size_t *n1, const size_t *n2, size_t num_series,
+                  size_t m, bool normalize, int num_threads) {
+    (void)num_threads;
+    if (I) {
+        throw std::runtime_error("Matrix profile index is not supported on the VE backend.");
+    }
+    for (size_t s = 0; s < num_series; s++) {
+        abjoin(T1[s], T2[s], P[s], n1[s], n2[s], m, 0, normalize);
+    }
+}
+
+void selfjoin_batch(const float *const *, float *const *, int64_t *const *, const size_t *,
+                    size_t, size_t, bool, int) {
+    throw std::runtime_error("Single precision is not supported on the VE backend.");
+}
+
+void abjoin_batch(const float *const *, const float *const *, float *const *, int64_t *const *,
+                  const size_t *, const size_t *, size_t, size_t, bool, int) {
+    throw std::runtime_error("Single precision is not supported on the VE backend.");
+}
+
+// Operations are queued on the VEDA stream, but the device buffers are returned to the pool
+// right after them, so the asynchronous versions wait for completion like the synchronous ones
+void sliding_dot_product_async(const double *T, const double *Q, double *QT, size_t n, size_t m,
+                               int stream) {
+    sliding_dot_product(T, Q, QT, n, m, stream);
+}
+
+void sliding_dot_product_async(const float *T, const float *Q, float *QT, size_t n, size_t m,
+                               int stream) {
+    sliding_dot_product(T, Q, QT, n, m, stream);
+}
+
+void compute_mean_std_async(const double *T, double *mu, double *sigma, size_t n, size_t m,
+                            int stream) {
+    compute_mean_std(T, mu, sigma, n, m, stream);
+}
+
+void compute_mean_std_async(const float *T, float *mu, float *sigma, size_t n, size_t m,
+                            int stream) {
+    compute_mean_std(T, mu, sigma, n, m, stream);
+}
+
+void selfjoin_async(const double *T, double *P, int64_t *I, size_t n, size_t m, int stream,
+                    bool normalize, int num_threads) {
+    if (I) {
+        selfjoin(T, P, I, n, m, stream, normalize, num_threads);
+    } else {
+        selfjoin(T, P, n, m, stream, normalize, num_threads);
+    }
+}
+
+void selfjoin_async(const float *T, float *P, int64_t *I, size_t n, size_t m, int stream,
+                    bool normalize, int num_threads) {
+    selfjoin(T, P, I, n, m, stream, normalize, num_threads);
+}
+
+void abjoin_async(const double *T1, const double *T2, double *P, int64_t *I, size_t n1,
+                  size_t n2, size_t m, int stream, bool normalize) {
+    if (I) {
+        abjoin(T1, T2, P, I, n1, n2, m, stream, normalize);
+    } else {
+        abjoin(T1, T2, P, n1, n2, m, stream, normalize);
+    }
+}
+
+void abjoin_async(const float *T1, const float *T2, float *P, int64_t *I, size_t n1, size_t n2,
+                  size_t m, int stream, bool normalize) {
+    abjoin(T1, T2, P, I, n1, n2, m, stream, normalize);
+}
+
+void stream_synchronize(int stream) {
+    current_device();
+    VEDA_CHECK(vedaStreamSynchronize(static_cast<VEDAstream>(stream)));
+}
+
+// Operations are complete when their calls return, so events are always complete
+struct Event::Impl {};
+
+Event::Event() : impl_(new Impl()) {}
+
+Event::~Event() = default;
+
+Event::Event(Event &&) noexcept = default;
+
+Event &Event::operator=(Event &&) noexcept = default;
+
+void Event::record(int) {}
+
+bool Event::query() const { return true; }
+
+void Event::synchronize() const {}
+
+void Event::add_callback(std::function<void()> callback) const { callback(); }
+
+void stream_wait_event(int, const Event &) {}
+
+void selfjoin_file(const char *, const char *, const char *, size_t, bool, int, size_t) {
+    throw std::runtime_error("Out-of-core joins are not supported on the VE backend.");
+}
+
+void abjoin_file(const char *, const char *, const char *, const char *, size_t, bool, int,
+                 size_t) {
+    throw std::runtime_error("Out-of-core joins are not supported on the VE backend.");
+}
+
+void selfjoin_tile(const double *, size_t, size_t, size_t, size_t, size_t, size_t, double *,
+                   int64_t *, double *, int64_t *, bool, int) {
+    throw std::runtime_error("Tiled joins are not supported on the VE backend.");
+}
+
+void merge_profiles(double *, int64_t *, const double *, const int64_t *, size_t) {
+    throw std::runtime_error("Tiled joins are not supported on the VE backend.");
+}
+
+size_t topk_motifs(const double *, size_t, size_t, size_t, int64_t *, int64_t *, double *, int,
+                   bool, int) {
+    throw std::runtime_error("Top-k motifs are not supported on the VE backend.");
+}
+
+size_t topk_discords(const double *, size_t, size_t, size_t, int64_t *, int64_t *, double *, int,
+                     bool, int) {
+    throw std::runtime_error("Top-k discords are not supported on the VE backend.");
+}
+
+size_t topk_motifs(const float *, size_t, size_t, size_t, int64_t *, int64_t *, float *, int,
+                   bool, int) {
+    throw std::runtime_error("Single precision is not supported on the VE backend.");
+}
+
+size_t topk_discords(const float *, size_t, size_t, size_t, int64_t *, int64_t *, float *, int,
+                     bool, int) {
+    throw std::runtime_error("Single precision is not supported on the VE backend.");
+}
+
+struct Plan::Impl {};
+
+Plan::Plan(size_t, size_t, bool, int) {
+    throw std::runtime_error("Plans are not supported on the VE backend.");
+}
+
+Plan::~Plan() = default;
+
+Plan::Plan(Plan &&) noexcept = default;
+
+Plan &Plan::operator=(Plan &&) noexcept = default;
+
+void Plan::execute(const double *, double *, int64_t *) {
+    throw std::runtime_error("Plans are not supported on the VE backend.");
+}
+
+size_t Plan::size() const { return 0; }
+
+size_t Plan::window_size() const { return 0; }
+
+size_t Plan::profile_size() const { return 0; }
+
+struct StreamingSelfJoin::Impl {};
+
+StreamingSelfJoin::StreamingSelfJoin(const double *, size_t, size_t, bool, size_t) {
+    throw std::runtime_error("Streaming self-join is not supported on the VE backend.");
+}
+
+StreamingSelfJoin::~StreamingSelfJoin() = default;
+
+StreamingSelfJoin::StreamingSelfJoin(StreamingSelfJoin &&) noexcept = default;
+
+StreamingSelfJoin &StreamingSelfJoin::operator=(StreamingSelfJoin &&) noexcept = default;
+
+void StreamingSelfJoin::append(const double *, size_t) {
+    throw std::runtime_error("Streaming self-join is not supported on the VE backend.");
+}
+
+size_t StreamingSelfJoin::size() const { return 0; }
+
+size_t StreamingSelfJoin::window_size() const { return 0; }
+
+size_t StreamingSelfJoin::profile_size() const { return 0; }
+
+const double *StreamingSelfJoin::data() const { return nullptr; }
+
+const double *StreamingSelfJoin::profile() const { return nullptr; }
+
+const int64_t *StreamingSelfJoin::index() const { return nullptr; }
+
+struct AnytimeSelfJoin::Impl {};
+
+AnytimeSelfJoin::AnytimeSelfJoin(const double *, size_t, size_t, bool, int, uint64_t, bool) {
+    throw std::runtime_error("Anytime self-join is not supported on the VE backend.");
+}
+
+AnytimeSelfJoin::~AnytimeSelfJoin() = default;
+
+AnytimeSelfJoin::AnytimeSelfJoin(AnytimeSelfJoin &&) noexcept = default;
+
+AnytimeSelfJoin &AnytimeSelfJoin::operator=(AnytimeSelfJoin &&) noexcept = default;
+
+bool AnytimeSelfJoin::run(double, double) {
+    throw std::runtime_error("Anytime self-join is not supported on the VE backend.");
+}
+
+double AnytimeSelfJoin::progress() const { return 0.0; }
+
+bool AnytimeSelfJoin::done() const { return false; }
+
+size_t AnytimeSelfJoin::profile_size() const { return 0; }
+
+const double *AnytimeSelfJoin::profile() const { return nullptr; }
+
+const int64_t *AnytimeSelfJoin::index() const { return nullptr; }
+
 void sleep_us(uint64_t microseconds, int stream) {
     DeviceContext& dev = current_device();
     VEDAstream veda_stream = static_cast<VEDAstream>(stream);
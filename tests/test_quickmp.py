@@ -1,3 +1,8 @@
+import asyncio
+import os
+import subprocess
+import sys
+import threading
 from concurrent.futures import ThreadPoolExecutor
 
 import numpy as np
@@ -14,7 +19,7 @@ def setup_quickmp():
     quickmp.finalize()
 
 
-@pytest.mark.parametrize("n,m", [(100, 10), (500, 20), (1000, 100)])
+@pytest.mark.parametrize("n,m", [(100, 10), (500, 20), (1000, 100), (2000, 500)])
 def test_sliding_dot_product(n, m):
     T = np.random.rand(n)
     Q = np.random.rand(m)
@@ -40,7 +45,7 @@ def test_compute_mean_std(n, m):
         assert np.isclose(np.std(T[i:i+m]), sigma[i])
 
 
-@pytest.mark.parametrize("n,m", [(100, 10), (500, 20), (1000, 100)])
+@pytest.mark.parametrize("n,m", [(100, 10), (500, 20), (1000, 100), (2000, 500)])
 def test_selfjoin(n, m):
     T = np.random.rand(n)
 
@@ -50,7 +55,19 @@ def test_selfjoin(n, m):
     assert np.allclose(mp, mp2)
 
 
-@pytest.mark.parametrize("n,m", [(100, 10), (500, 20), (1000, 100)])
+@pytest.mark.parametrize("normalize", [True, False])
+@pytest.mark.parametrize("num_threads", [0, 2, 4, 100000])
+def test_selfjoin_num_threads(num_threads, normalize):
+    n, m = 1000, 20
+    T = np.random.rand(n)
+
+    mp = quickmp.selfjoin(T, m, normalize=normalize, num_threads=num_threads)
+    mp2 = stumpy.stump(T, m, normalize=normalize)[:, 0].astype(np.float64)
+
+    assert np.allclose(mp, mp2)
+
+
+@pytest.mark.parametrize("n,m", [(100, 10), (500, 20), (1000, 100), (2000, 500)])
 def test_abjoin(n, m):
     T1 = np.random.rand(n)
     T2 = np.random.rand(n)
@@ -82,6 +99,424 @@ def test_abjoin_unnormalized(n, m):
     assert np.allclose(mp, mp2)
 
 
+def distance(A, B, normalize):
+    if normalize:
+        A = (A - np.mean(A)) / np.std(A)
+        B = (B - np.mean(B)) / np.std(B)
+    return np.linalg.norm(A - B)
+
+
+@pytest.mark.parametrize("normalize", [True, False])
+@pytest.mark.parametrize("num_threads", [1, 4])
+def test_selfjoin_index(num_threads, normalize):
+    n, m = 500, 20
+    T = np.random.rand(n)
+
+    mp, mpi = quickmp.selfjoin(T, m, normalize=normalize, num_threads=num_threads,
+                               return_index=True)
+    mp2 = stumpy.stump(T, m, normalize=normalize)[:, 0].astype(np.float64)
+
+    assert mpi.dtype == np.int64
+    assert np.allclose(mp, mp2)
+
+    # Neighbors may differ from stumpy on ties, so check their distances instead
+    dist = [distance(T[i:i+m], T[j:j+m], normalize) for i, j in enumerate(mpi)]
+    assert np.allclose(dist, mp2)
+
+
+@pytest.mark.parametrize("normalize", [True, False])
+@pytest.mark.parametrize("num_threads", [1, 4])
+def test_selfjoin_low_memory(num_threads, normalize):
+    n, m = 5000, 50
+    T = np.cumsum(np.random.rand(n) - 0.5)
+
+    mp, mpi = quickmp.selfjoin(T, m, normalize=normalize, num_threads=num_threads,
+                               return_index=True, low_memory=True)
+    mp2 = quickmp.selfjoin(T, m, normalize=normalize)
+
+    assert np.allclose(mp, mp2, atol=1e-3)
+
+    dist = [distance(T[i:i+m], T[j:j+m], normalize) for i, j in enumerate(mpi)]
+    assert np.allclose(dist, mp2, atol=1e-3)
+
+
+@pytest.mark.parametrize("normalize", [True, False])
+def test_abjoin_index(normalize):
+    n, m = 500, 20
+    T1 = np.random.rand(n)
+    T2 = np.random.rand(n + 50)
+
+    mp, mpi = quickmp.abjoin(T1, T2, m, normalize=normalize, return_index=True)
+    mp2 = stumpy.stump(T_A=T1, T_B=T2, m=m, ignore_trivial=False,
+                       normalize=normalize)[:, 0].astype(np.float64)
+
+    assert mpi.dtype == np.int64
+    assert np.allclose(mp, mp2)
+
+    dist = [distance(T1[i:i+m], T2[j:j+m], normalize) for i, j in enumerate(mpi)]
+    assert np.allclose(dist, mp2)
+
+
+@pytest.mark.parametrize("dtype", [np.float64, np.float32])
+def test_out(dtype):
+    n, m = 500, 20
+    T = np.random.rand(n).astype(dtype)
+    T2 = np.random.rand(n + 50).astype(dtype)
+
+    out = np.empty(n - m + 1, dtype=dtype)
+    out_index = np.empty(n - m + 1, dtype=np.int64)
+
+    mp, mpi = quickmp.selfjoin(T, m, return_index=True, out=out, out_index=out_index)
+    assert mp is out and mpi is out_index
+    assert np.array_equal(out, quickmp.selfjoin(T, m))
+
+    assert quickmp.abjoin(T, T2, m, out=out) is out
+    assert np.array_equal(out, quickmp.abjoin(T, T2, m))
+
+    assert quickmp.sliding_dot_product(T, T[:m], out=out) is out
+    assert np.array_equal(out, quickmp.sliding_dot_product(T, T[:m]))
+
+    mu, sigma = np.empty_like(out), np.empty_like(out)
+    result = quickmp.compute_mean_std(T, m, out=(mu, sigma))
+    assert result[0] is mu and result[1] is sigma
+
+    with pytest.raises(RuntimeError):
+        quickmp.selfjoin(T, m, out=np.empty(n, dtype=dtype))
+
+
+@pytest.mark.parametrize("normalize", [True, False])
+@pytest.mark.parametrize("num_threads", [1, 4])
+def test_selfjoin_float32(num_threads, normalize):
+    n, m = 2000, 50
+    T = np.random.rand(n).astype(np.float32)
+
+    mp = quickmp.selfjoin(T, m, normalize=normalize, num_threads=num_threads)
+    mp2 = stumpy.stump(T.astype(np.float64), m, normalize=normalize)[:, 0].astype(np.float64)
+
+    assert mp.dtype == np.float32
+    assert np.allclose(mp, mp2, rtol=1e-3, atol=1e-3)
+
+
+@pytest.mark.parametrize("low_memory", [True, False])
+@pytest.mark.parametrize("normalize", [True, False])
+def test_selfjoin_float32_no_neighbor(normalize, low_memory):
+    n, m = 60, 40
+    T = np.random.rand(n).astype(np.float32)
+
+    mp, mpi = quickmp.selfjoin(T, m, normalize=normalize, return_index=True,
+                               low_memory=low_memory)
+    mp2 = stumpy.stump(T.astype(np.float64), m, normalize=normalize)[:, 0].astype(np.float64)
+
+    assert not np.any(np.isnan(mp))
+    assert np.any(mpi < 0)
+    assert np.all(np.isinf(mp[mpi < 0]))
+    assert np.allclose(mp, mp2, rtol=1e-3, atol=1e-3)
+
+
+@pytest.mark.parametrize("normalize", [True, False])
+def test_abjoin_float32(normalize):
+    n, m = 1000, 50
+    T1 = np.random.rand(n).astype(np.float32)
+    T2 = np.random.rand(n + 50).astype(np.float32)
+
+    mp = quickmp.abjoin(T1, T2, m, normalize=normalize)
+    mp2 = stumpy.stump(T_A=T1.astype(np.float64), T_B=T2.astype(np.float64), m=m,
+                       ignore_trivial=False, normalize=normalize)[:, 0].astype(np.float64)
+
+    assert mp.dtype == np.float32
+    assert np.allclose(mp, mp2, rtol=1e-3, atol=1e-3)
+
+
+@pytest.mark.parametrize("dtype", [np.int16, np.int64, np.uint8, np.float32, np.float64])
+def test_selfjoin_any_dtype(dtype):
+    n, m = 1000, 50
+    frame = (np.random.rand(n, 3) * 100).astype(dtype)
+    T = frame[:, 1]
+    T2 = frame[::-1, 2]
+
+    mp = quickmp.selfjoin(T, m)
+    mp2 = quickmp.selfjoin(np.ascontiguousarray(T), m)
+    assert mp.dtype == (np.float32 if dtype == np.float32 else np.float64)
+    assert np.allclose(mp, mp2)
+
+    mp = quickmp.abjoin(T, T2, m)
+    mp2 = quickmp.abjoin(np.ascontiguousarray(T), np.ascontiguousarray(T2), m)
+    assert np.allclose(mp, mp2)
+
+
+@pytest.mark.parametrize("normalize", [True, False])
+def test_selfjoin_batch(normalize):
+    m = 20
+    Ts = np.random.rand(10, 500)
+
+    mp = quickmp.selfjoin_batch(Ts, m, normalize=normalize)
+
+    assert mp.shape == (10, 500 - m + 1)
+    for T, P in zip(Ts, mp):
+        assert np.allclose(P, quickmp.selfjoin(T, m, normalize=normalize))
+
+    # Time series of different lengths
+    Ts = [np.random.rand(n) for n in [100, 800, 300, 50]]
+
+    mp, mpi = quickmp.selfjoin_batch(Ts, m, normalize=normalize, return_index=True)
+
+    for T, P, I in zip(Ts, mp, mpi):
+        P2, I2 = quickmp.selfjoin(T, m, normalize=normalize, return_index=True)
+        assert np.allclose(P, P2)
+        assert np.array_equal(I, I2)
+
+
+@pytest.mark.parametrize("normalize", [True, False])
+def test_abjoin_batch(normalize):
+    m = 20
+    T1s = [np.random.rand(n) for n in [100, 800, 300]]
+    T2s = [np.random.rand(n) for n in [500, 60, 300]]
+
+    mp = quickmp.abjoin_batch(T1s, T2s, m, normalize=normalize)
+
+    for T1, T2, P in zip(T1s, T2s, mp):
+        assert np.allclose(P, quickmp.abjoin(T1, T2, m, normalize=normalize))
+
+
+def topk_reference(mp, mpi, m, k, discords):
+    excl_zone = int(np.ceil(m / 4))
+    suppressed = np.zeros(len(mp), dtype=bool)
+    result = []
+
+    for i in np.argsort(-mp if discords else mp, kind="stable"):
+        if len(result) == k:
+            break
+        if suppressed[i]:
+            continue
+        result.append((i, mpi[i], mp[i]))
+        for j in [i] if discords else [i, mpi[i]]:
+            suppressed[max(j - excl_zone, 0):j + excl_zone + 1] = True
+
+    return result
+
+
+@pytest.mark.parametrize("discords", [False, True])
+@pytest.mark.parametrize("normalize", [True, False])
+def test_topk(normalize, discords):
+    n, m, k = 1000, 20, 5
+    T = np.random.rand(n)
+
+    topk = quickmp.topk_discords if discords else quickmp.topk_motifs
+    result = topk(T, m, k, normalize=normalize)
+
+    mp, mpi = quickmp.selfjoin(T, m, normalize=normalize, return_index=True)
+    expected = topk_reference(mp, mpi, m, k, discords)
+
+    assert len(result) == k
+    for (i, j, d), (i2, j2, d2) in zip(result, expected):
+        assert (i, j) == (i2, j2)
+        assert np.isclose(d, d2)
+
+    assert len(topk(T, m, 0, normalize=normalize)) == 0
+
+
+@pytest.mark.parametrize("dtype", [np.float64, np.float32])
+def test_topk_discords_short_series(dtype):
+    # The middle subsequences have no neighbor outside the exclusion zone
+    n, m = 60, 40
+    T = np.random.rand(n).astype(dtype)
+
+    for i, j, d in quickmp.topk_discords(T, m, 3):
+        assert j >= 0
+        assert np.isfinite(d)
+
+@pytest.mark.parametrize("normalize", [True, False])
+@pytest.mark.parametrize("m", [10, 300])
+def test_plan(m, normalize):
+    n = 2000
+    plan = quickmp.Plan(n, m, normalize=normalize)
+
+    for _ in range(3):
+        T = np.random.rand(n)
+        mp, mpi = plan.execute(T, return_index=True)
+        mp2, mpi2 = quickmp.selfjoin(T, m, normalize=normalize, return_index=True)
+
+        assert np.allclose(mp, mp2)
+        assert np.array_equal(mpi, mpi2)
+
+    with pytest.raises(RuntimeError):
+        plan.execute(np.random.rand(n + 1))
+
+
+def test_plan_threads():
+    n, m = 2000, 50
+    num_threads = 4
+    plan = quickmp.Plan(n, m)
+    Ts = [np.random.rand(n) for _ in range(num_threads)]
+    barrier = threading.Barrier(num_threads)
+
+    def worker(T):
+        barrier.wait()
+        return [plan.execute(T) for _ in range(3)]
+
+    with ThreadPoolExecutor(max_workers=num_threads) as executor:
+        results = list(executor.map(worker, Ts))
+
+    for T, mps in zip(Ts, results):
+        expected = quickmp.selfjoin(T, m)
+        for mp in mps:
+            assert np.allclose(mp, expected)
+
+
+@pytest.mark.parametrize("normalize", [True, False])
+def test_streaming_selfjoin(normalize):
+    n, m = 500, 20
+    T = np.random.rand(n)
+
+    stream = quickmp.StreamingSelfJoin(T[:300], m, normalize=normalize, capacity=n)
+    stream.append(T[300:450])
+    for value in T[450:]:
+        stream.append(value)
+
+    mp2 = stumpy.stump(T, m, normalize=normalize)[:, 0].astype(np.float64)
+
+    assert np.array_equal(stream.T, T)
+    assert np.allclose(stream.P, mp2)
+
+    dist = [distance(T[i:i+m], T[j:j+m], normalize) for i, j in enumerate(stream.I)]
+    assert np.allclose(dist, mp2)
+
+
+def test_streaming_selfjoin_threads():
+    n, m = 2000, 20
+    T = np.random.rand(n)
+
+    # No capacity, so that appends reallocate while the other thread copies
+    stream = quickmp.StreamingSelfJoin(T[:100], m)
+    done = threading.Event()
+    lengths = []
+
+    def reader():
+        while not done.is_set():
+            P = stream.P
+            lengths.append((len(P), len(stream.T)))
+
+    thread = threading.Thread(target=reader)
+    thread.start()
+    for chunk in np.array_split(T[100:], 50):
+        stream.append(chunk)
+    done.set()
+    thread.join()
+
+    # Every copy was taken between two appends
+    assert all(l + m - 1 <= t for l, t in lengths)
+    assert np.array_equal(stream.T, T)
+    assert np.allclose(stream.P, quickmp.selfjoin(T, m))
+
+
+@pytest.mark.parametrize("normalize", [True, False])
+@pytest.mark.parametrize("num_threads", [1, 4])
+def test_anytime_selfjoin(num_threads, normalize):
+    n, m = 1000, 20
+    T = np.random.rand(n)
+
+    mp2 = stumpy.stump(T, m, normalize=normalize)[:, 0].astype(np.float64)
+
+    anytime = quickmp.AnytimeSelfJoin(T, m, normalize=normalize, num_threads=num_threads)
+    mp = anytime.run(fraction=0.3)
+
+    assert not anytime.done
+    assert np.all(mp >= mp2 - 1e-8)
+
+    # Resume until the profile is exact
+    while not anytime.done:
+        mp = anytime.run(fraction=0.3)
+
+    assert np.isclose(anytime.progress, 1.0)
+    assert np.allclose(mp, mp2)
+
+    dist = [distance(T[i:i+m], T[j:j+m], normalize) for i, j in enumerate(anytime.I)]
+    assert np.allclose(dist, mp2)
+
+
+def test_anytime_selfjoin_threads():
+    n, m = 2000, 20
+    T = np.random.rand(n)
+    num_threads = 4
+
+    anytime = quickmp.AnytimeSelfJoin(T, m)
+    barrier = threading.Barrier(num_threads)
+
+    def worker(_):
+        barrier.wait()
+        while not anytime.done:
+            anytime.run(fraction=0.05)
+            anytime.P, anytime.I
+
+    with ThreadPoolExecutor(max_workers=num_threads) as executor:
+        list(executor.map(worker, range(num_threads)))
+
+    assert np.isclose(anytime.progress, 1.0)
+    assert np.allclose(anytime.P, quickmp.selfjoin(T, m))
+
+
+@pytest.mark.parametrize("normalize", [True, False])
+@pytest.mark.parametrize("num_threads", [1, 4])
+def test_selfjoin_file(tmp_path, num_threads, normalize):
+    n, m = 6000, 50
+    T1 = np.random.rand(n)
+    T2 = np.random.rand(n - 500)
+
+    np.save(tmp_path / "T1.npy", T1)
+    T2.tofile(tmp_path / "T2.bin")
+
+    # A tiny budget splits the time series into blocks of the minimum length
+    quickmp.selfjoin_file(tmp_path / "T1.npy", tmp_path / "P.npy", m,
+                          output_index=tmp_path / "I.npy", normalize=normalize,
+                          num_threads=num_threads, memory_budget=1)
+    mp = quickmp.selfjoin(T1, m, normalize=normalize)
+
+    assert np.allclose(np.load(tmp_path / "P.npy"), mp)
+
+    dist = [distance(T1[i:i+m], T1[j:j+m], normalize)
+            for i, j in enumerate(np.load(tmp_path / "I.npy"))]
+    assert np.allclose(dist, mp)
+
+    quickmp.abjoin_file(tmp_path / "T1.npy", tmp_path / "T2.bin", tmp_path / "P.bin", m,
+                        normalize=normalize, num_threads=num_threads, memory_budget=1)
+    mp = quickmp.abjoin(T1, T2, m, normalize=normalize)
+
+    assert np.allclose(np.fromfile(tmp_path / "P.bin"), mp)
+
+
+@pytest.mark.parametrize("normalize", [True, False])
+@pytest.mark.parametrize("return_cols", [True, False])
+def test_selfjoin_tile(return_cols, normalize):
+    n, m = 1000, 20
+    T = np.random.rand(n)
+    l = n - m + 1
+
+    mp2 = stumpy.stump(T, m, normalize=normalize)[:, 0].astype(np.float64)
+
+    P = np.full(l, np.inf)
+    I = np.full(l, -1, dtype=np.int64)
+
+    bounds = [0, 100, 350, 360, 800, l]
+    for a in range(len(bounds) - 1):
+        # With the column profiles, tiles on and above the main diagonal cover the matrix
+        for b in range(a if return_cols else 0, len(bounds) - 1):
+            rows, cols = (bounds[a], bounds[a + 1]), (bounds[b], bounds[b + 1])
+            result = quickmp.selfjoin_tile(T, m, rows, cols, normalize=normalize,
+                                           return_cols=return_cols)
+
+            quickmp.merge_profiles(P[rows[0]:rows[1]], I[rows[0]:rows[1]], *result[:2])
+            if return_cols:
+                quickmp.merge_profiles(P[cols[0]:cols[1]], I[cols[0]:cols[1]], *result[2:])
+
+    assert np.allclose(P, mp2)
+
+    dist = [distance(T[i:i+m], T[j:j+m], normalize) for i, j in enumerate(I)]
+    assert np.allclose(dist, mp2)
+
+    with pytest.raises(RuntimeError):
+        quickmp.selfjoin_tile(T, m, (0, 100), (0, 100), num_threads=-1)
+
+
 def test_init_finalize():
     """Test explicit init/finalize."""
     # Already initialized by fixture, finalize first
@@ -199,3 +634,273 @@ def test_multithread_selfjoin():
         results = list(executor.map(worker, test_data))
 
     assert len(results) == num_threads
+
+
+def test_concurrent_initialize():
+    quickmp.finalize()
+    num_threads = 8
+    barrier = threading.Barrier(num_threads)
+
+    def worker(_):
+        barrier.wait()
+        try:
+            quickmp.initialize()
+            return True
+        except RuntimeError:
+            return False
+
+    with ThreadPoolExecutor(max_workers=num_threads) as executor:
+        results = list(executor.map(worker, range(num_threads)))
+
+    # Exactly one thread initializes the backend; the fixture finalizes it
+    assert results.count(True) == 1
+
+
+@pytest.mark.skipif((os.cpu_count() or 1) < 2, reason="needs at least 2 cores")
+def test_cpu_devices():
+    quickmp.finalize()
+    quickmp.initialize(cpu_devices=2)
+    assert quickmp.get_device_count() == 2
+
+    n, m = 500, 20
+    T = np.random.rand(n)
+    expected = stumpy.stump(T, m)[:, 0].astype(np.float64)
+
+    def worker(device):
+        quickmp.use_device(device)
+        assert quickmp.get_current_device() == device
+        streams = quickmp.get_stream_count()
+        pending = [quickmp.selfjoin_async(T, m, stream=s) for s in range(streams)]
+        return [p.result() for p in pending] + [quickmp.selfjoin(T, m, num_threads=0)]
+
+    with ThreadPoolExecutor(max_workers=2) as executor:
+        for results in executor.map(worker, range(2)):
+            for mp in results:
+                assert np.allclose(mp, expected)
+
+    assert quickmp.get_stream_count() <= (os.cpu_count() + 1) // 2
+    with pytest.raises(RuntimeError):
+        quickmp.use_device(2)
+
+
+def test_backends():
+    backends = quickmp.list_backends()
+    assert "cpu" in backends and "cpu-generic" in backends
+    assert quickmp.get_backend() == "cpu"
+
+    n, m = 500, 20
+    T = np.random.rand(n)
+    expected = stumpy.stump(T, m)[:, 0].astype(np.float64)
+
+    for backend in backends:
+        quickmp.finalize()
+        quickmp.initialize(backend=backend)
+        assert quickmp.get_backend() == backend
+        assert np.allclose(quickmp.selfjoin(T, m), expected)
+
+    quickmp.finalize()
+    with pytest.raises(RuntimeError):
+        quickmp.initialize(backend="cpu-unknown")
+    quickmp.initialize()
+
+
+# Run by test_simd_isa in a child process, since QUICKMP_SIMD is read once per process
+SIMD_SCRIPT = """
+import sys
+import numpy as np
+import quickmp
+
+quickmp.initialize()
+inputs = np.load(sys.argv[1])
+m = int(inputs["m"])
+results = {}
+for dtype in ("float32", "float64"):
+    T1, T2 = inputs["T1"].astype(dtype), inputs["T2"].astype(dtype)
+    for normalize in (True, False):
+        key = f"{dtype}_{normalize}"
+        results["selfjoin_" + key] = quickmp.selfjoin(T1, m, normalize=normalize)
+        results["selfjoin_index_" + key] = quickmp.selfjoin(T1, m, normalize=normalize,
+                                                            return_index=True)[1]
+        results["abjoin_" + key] = quickmp.abjoin(T1, T2, m, normalize=normalize)
+        results["abjoin_index_" + key] = quickmp.abjoin(T1, T2, m, normalize=normalize,
+                                                        return_index=True)[1]
+np.savez(sys.argv[2], **results)
+quickmp.finalize()
+"""
+
+
+@pytest.mark.parametrize("isa", ["generic", "avx2", "avx512"])
+def test_simd_isa(isa, tmp_path):
+    if "cpu-" + isa not in quickmp.list_backends():
+        pytest.skip(isa + " not supported by the CPU")
+
+    n, m = 500, 20
+    T1 = np.random.rand(n)
+    T2 = np.random.rand(n + 50)
+    np.savez(tmp_path / "inputs.npz", T1=T1, T2=T2, m=m)
+
+    subprocess.run([sys.executable, "-c", SIMD_SCRIPT, str(tmp_path / "inputs.npz"),
+                    str(tmp_path / "results.npz")],
+                   env=dict(os.environ, QUICKMP_SIMD=isa), check=True)
+    results = np.load(tmp_path / "results.npz")
+
+    for normalize in (True, False):
+        mp_self = stumpy.stump(T1, m, normalize=normalize)[:, 0].astype(np.float64)
+        mp_ab = stumpy.stump(T_A=T1, T_B=T2, m=m, ignore_trivial=False,
+                             normalize=normalize)[:, 0].astype(np.float64)
+
+        for dtype, rtol, atol in (("float32", 1e-3, 1e-3), ("float64", 1e-5, 1e-8)):
+            key = f"{dtype}_{normalize}"
+            assert results["selfjoin_" + key].dtype == dtype
+            assert np.allclose(results["selfjoin_" + key], mp_self, rtol=rtol, atol=atol)
+            assert np.allclose(results["abjoin_" + key], mp_ab, rtol=rtol, atol=atol)
+
+            # Neighbors may differ from stumpy on ties, so check their distances instead
+            dist = [distance(T1[i:i+m], T1[j:j+m], normalize)
+                    for i, j in enumerate(results["selfjoin_index_" + key])]
+            assert np.allclose(dist, mp_self, rtol=rtol, atol=atol)
+            dist = [distance(T1[i:i+m], T2[j:j+m], normalize)
+                    for i, j in enumerate(results["abjoin_index_" + key])]
+            assert np.allclose(dist, mp_ab, rtol=rtol, atol=atol)
+
+
+@pytest.mark.skipif(not sys.platform.startswith("linux"), reason="Linux only")
+@pytest.mark.parametrize("affinity", ["compact", "scatter", "cpus"])
+def test_affinity(affinity):
+    quickmp.finalize()
+    if affinity == "cpus":
+        cpus = sorted(os.sched_getaffinity(0))[:2]
+        quickmp.initialize(cpus=cpus)
+        assert quickmp.get_stream_count() == min(len(cpus),
+                                                 quickmp.get_cpu_topology()["usable_cpus"])
+    else:
+        quickmp.initialize(affinity=affinity)
+
+    n, m = 500, 20
+    T = np.random.rand(n)
+    expected = stumpy.stump(T, m)[:, 0].astype(np.float64)
+
+    assert np.allclose(quickmp.selfjoin_async(T, m).result(), expected)
+    assert np.allclose(quickmp.selfjoin(T, m, num_threads=0), expected)
+
+
+@pytest.mark.skipif(not sys.platform.startswith("linux"), reason="Linux only")
+def test_invalid_affinity():
+    quickmp.finalize()
+    with pytest.raises(RuntimeError):
+        quickmp.initialize(affinity="everywhere")
+    with pytest.raises(RuntimeError):
+        quickmp.initialize(cpus=[-1])
+    quickmp.initialize()
+
+
+def test_cpu_topology():
+    topology = quickmp.get_cpu_topology()
+    usable = topology["usable_cpus"]
+
+    assert 1 <= usable <= topology["hardware_threads"]
+    assert usable <= topology["affinity_cpus"]
+    if hasattr(os, "sched_getaffinity"):
+        assert topology["affinity_cpus"] == len(os.sched_getaffinity(0))
+    if topology["cpu_quota"] > 0:
+        assert usable <= np.ceil(topology["cpu_quota"])
+    assert quickmp.get_stream_count() == usable
+
+
+def test_selfjoin_async():
+    n, m = 500, 20
+    num_streams = min(quickmp.get_stream_count(), 4)
+    Ts = [np.random.rand(n) for _ in range(8)]
+
+    pending = [quickmp.selfjoin_async(T, m, stream=i % num_streams, return_index=True)
+               for i, T in enumerate(Ts)]
+
+    event = quickmp.Event()
+    event.record(0)
+    quickmp.stream_wait_event(num_streams - 1, event)
+    ab = quickmp.abjoin_async(Ts[0], Ts[1], m, stream=num_streams - 1)
+
+    for T, p in zip(Ts, pending):
+        mp, mpi = p.result()
+        assert p.done()
+        assert np.allclose(mp, stumpy.stump(T, m)[:, 0].astype(np.float64))
+
+    event.synchronize()
+    assert event.query()
+    assert np.allclose(ab.result(), quickmp.abjoin(Ts[0], Ts[1], m))
+
+    # Failures are raised by the stream
+    quickmp.selfjoin_async(Ts[0], m, num_threads=-1)
+    with pytest.raises(RuntimeError):
+        quickmp.stream_synchronize(0)
+    quickmp.stream_synchronize(0)
+
+    with pytest.raises(RuntimeError):
+        quickmp.selfjoin_async(Ts[0], m, stream=quickmp.get_stream_count())
+
+
+def test_selfjoin_await():
+    n, m = 500, 20
+    num_streams = min(quickmp.get_stream_count(), 4)
+    Ts = [np.random.rand(n) for _ in range(64)]
+
+    async def run():
+        return await asyncio.gather(*[
+            quickmp.selfjoin_async(T, m, stream=i % num_streams) for i, T in enumerate(Ts)
+        ])
+
+    for T, mp in zip(Ts, asyncio.run(run())):
+        assert np.allclose(mp, stumpy.stump(T, m)[:, 0].astype(np.float64))
+
+    async def fail():
+        await quickmp.selfjoin_async(Ts[0], m, num_threads=-1)
+
+    with pytest.raises(RuntimeError):
+        asyncio.run(fail())
+    with pytest.raises(RuntimeError):
+        quickmp.stream_synchronize(0)
+
+    done = []
+    finished = threading.Event()
+    p = quickmp.selfjoin_async(Ts[0], m)
+    p.add_done_callback(lambda r: (done.append(r), finished.set()))
+    assert finished.wait(10)
+    assert done == [p]
+
+
+def test_trim_memory_pool():
+    n, m = 1000, 20
+    Ts = [np.random.rand(n) for _ in range(8)]
+    expected = [quickmp.selfjoin(T, m) for T in Ts]
+
+    # Arrays are returned to the pool by whichever thread drops them
+    with ThreadPoolExecutor(max_workers=4) as executor:
+        results = list(executor.map(lambda T: quickmp.selfjoin(T, m), Ts))
+    quickmp.trim_memory_pool()
+
+    for mp, mp2 in zip(results, expected):
+        assert np.allclose(mp, mp2)
+    del results
+    quickmp.trim_memory_pool()
+
+    assert np.allclose(quickmp.selfjoin(Ts[0], m), expected[0])
+
+
+def test_initialize_allocation_policy():
+    T = np.random.rand(10000)
+    m = 100
+    expected = quickmp.selfjoin(T, m, num_threads=4)
+
+    # Large enough for the FFT buffers to be affected by the policy
+    T2 = np.random.rand(1 << 20)
+    Q = np.random.rand(1000)
+    expected_qt = quickmp.sliding_dot_product(T2, Q)
+
+    quickmp.finalize()
+    quickmp.initialize(huge_pages=True, numa_local=True)
+
+    assert np.allclose(quickmp.selfjoin(T, m, num_threads=4), expected)
+    assert np.allclose(quickmp.sliding_dot_product(T2, Q), expected_qt)
+
+    quickmp.finalize()
+    quickmp.initialize()